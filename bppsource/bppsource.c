@@ -7,6 +7,23 @@
 #include <netinet/in.h>
 #include <netdb.h>
 #include <stdint.h>
+#include <arpa/inet.h>
+#include <sys/uio.h>
+#include "bppproto.h"
+
+//Per-connection state, indexed by fd: did the server agree to binary packet frames, and
+//which type was set at connect time (frames carry it in every header).
+#define MAX_CONN_FD 1024
+typedef struct {
+	uint8_t binary;
+	uint16_t type;
+} ConnState;
+static ConnState connState[MAX_CONN_FD];
+
+static ConnState *getConnState(int sockfd) {
+	if (sockfd<0 || sockfd>=MAX_CONN_FD) return NULL;
+	return &connState[sockfd];
+}
 
 int bppGetResponse(int sockfd, int *resp) {
 	char buf[128]={0};
@@ -38,7 +55,41 @@ int bppSet(int sockfd, int cmd, int val) {
 	return bppGetResponse(sockfd, &ret);
 }
 
+static int bppSendFrame(int sockfd, int type, int subtype, uint8_t *data, int len) {
+	BppFrameHdr h;
+	struct iovec iov[2];
+	memset(&h, 0, sizeof(h));
+	h.magic=BPP_FRAME_MAGIC;
+	h.flags=0;
+	h.type=htons(type);
+	h.subtype=htons(subtype);
+	h.len=htonl(len);
+	iov[0].iov_base=&h;
+	iov[0].iov_len=sizeof(h);
+	iov[1].iov_base=data;
+	iov[1].iov_len=len;
+	int left=sizeof(h)+len;
+	int iovn=0;
+	while (left>0) {
+		int i=writev(sockfd, &iov[iovn], 2-iovn);
+		if (i<=0) return -1;
+		left-=i;
+		//Skip past whatever got written
+		while (iovn<2 && i>=iov[iovn].iov_len) {
+			i-=iov[iovn].iov_len;
+			iovn++;
+		}
+		if (iovn<2) {
+			iov[iovn].iov_base=(uint8_t*)iov[iovn].iov_base+i;
+			iov[iovn].iov_len-=i;
+		}
+	}
+	return bppGetResponse(sockfd, NULL);
+}
+
 int bppSend(int sockfd, int subtype, uint8_t *data, int len) {
+	ConnState *cs=getConnState(sockfd);
+	if (cs && cs->binary) return bppSendFrame(sockfd, cs->type, subtype, data, len);
 	char buf[len*2+8];
 	int i;
 	sprintf(buf, "p %02x \n", subtype);
@@ -58,7 +109,7 @@ int bppCreateConnection(char *hostname, int type) {
 	struct hostent *server;
 	char buf[20];
 
-	portno=2017;
+	portno=BPP_TCP_PORT;
 
 	server = gethostbyname(hostname);
 	if (server == NULL) {
@@ -92,9 +143,20 @@ int bppCreateConnection(char *hostname, int type) {
 		return -1;
 	}
 
+	//Try to switch to binary packet frames. Older servers answer '-'; we keep using hex then.
+	ConnState *cs=getConnState(sockfd);
+	if (cs) {
+		cs->type=type;
+		cs->binary=0;
+		write(sockfd, "b\n", 2);
+		if (bppGetResponse(sockfd, NULL)==1) cs->binary=1;
+	}
+
 	return sockfd;
 }
 
 void bppClose(int sockfd) {
+	ConnState *cs=getConnState(sockfd);
+	if (cs) cs->binary=0;
 	close(sockfd);
 }
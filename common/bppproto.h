@@ -0,0 +1,33 @@
+/*
+Producer <-> server protocol, as spoken over TCP port 2017.
+
+The original protocol is line-based ASCII: single-letter commands, with packet payloads
+hex-encoded ('p <subtype> <hex>'). That still works, but a producer can send 'b' after
+connecting; if the server answers '+' it understands binary frames. A binary frame is a
+BppFrameHdr followed by len raw payload bytes, and is acknowledged with the same '+' or '-'
+line a 'p' command gets. After 'b', frames and ASCII commands can be mixed freely on one
+connection; a frame is recognized by its first byte, which can never start an ASCII command.
+Before it, everything is parsed as ASCII lines.
+*/
+#ifndef BPPPROTO_H
+#define BPPPROTO_H
+
+#include <stdint.h>
+
+#define BPP_TCP_PORT 2017
+
+#define BPP_FRAME_MAGIC 0xB5
+
+//No flags are defined yet; producers must send 0.
+
+//All fields are in network byte order.
+typedef struct {
+	uint8_t magic;		//must be BPP_FRAME_MAGIC
+	uint8_t flags;
+	uint16_t type;		//HL packet type
+	uint16_t subtype;	//HL packet subtype
+	uint16_t reserved;
+	uint32_t len;		//payload bytes following this header
+} __attribute__ ((packed)) BppFrameHdr;
+
+#endif
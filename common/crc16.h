@@ -31,5 +31,7 @@
 
 #include <stdint.h>
 unsigned short crc16_ccitt(uint16_t oldcrc, const void *buf, int len);
+/* Copy len bytes from src to dst, and return the CRC over them like crc16_ccitt does. */
+unsigned short crc16_ccitt_copy(uint16_t oldcrc, void *dst, const void *src, int len);
 
 #endif /* _CRC16_H_ */
@@ -16,6 +16,9 @@ int main() {
     unsigned char shared_secret[32], other_shared_secret[32];
     unsigned char signature[64];
 
+    static unsigned char precomp[ED25519_PRECOMP_SIZE(ED25519_PRECOMP_MAX_WINDOW)];
+    int window;
+
     clock_t start;
     clock_t end;
     int i;
@@ -117,6 +120,27 @@ int main() {
     end = clock();
 
     printf("%fus per signature\n", ((double) ((end - start) * 1000)) / CLOCKS_PER_SEC / i * 1000);
+
+    for (window = ED25519_PRECOMP_MIN_WINDOW; window <= ED25519_PRECOMP_MAX_WINDOW; ++window) {
+        ed25519_precompute_key(precomp, public_key, window);
+        if (!ed25519_verify_precomp(signature, message, message_len, public_key, precomp, window)) {
+            printf("precomputed verify (window %d) rejected a valid signature\n", window);
+        }
+        signature[44] ^= 0x10;
+        if (ed25519_verify_precomp(signature, message, message_len, public_key, precomp, window)) {
+            printf("precomputed verify (window %d) did not detect signature change\n", window);
+        }
+        signature[44] ^= 0x10;
+
+        printf("testing precomputed verify performance, window %d (%d byte table): ", window, ED25519_PRECOMP_SIZE(window));
+        start = clock();
+        for (i = 0; i < 10000; ++i) {
+            ed25519_verify_precomp(signature, message, message_len, public_key, precomp, window);
+        }
+        end = clock();
+
+        printf("%fus per signature\n", ((double) ((end - start) * 1000)) / CLOCKS_PER_SEC / i * 1000);
+    }
     
 
     printf("testing keypair scalar addition performance: ");
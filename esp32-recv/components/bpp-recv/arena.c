@@ -0,0 +1,69 @@
+/*
+Static memory pools for the receive pipeline. See arena.h.
+*/
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "structs.h"
+#include "arena.h"
+
+#define ALIGN_UP(x) (((x)+7)&~(size_t)7)
+
+static const size_t poolSize[ARENA_NO_POOLS]={
+	ALIGN_UP(ARENA_FEC_SIZE),
+	ALIGN_UP(ARENA_BLOCKDEC_SIZE),
+	ALIGN_UP(ARENA_MOUNT_SIZE),
+	ALIGN_UP(ARENA_HASH_WINDOW_SIZE),
+};
+
+static const char *poolName[ARENA_NO_POOLS]={
+	"fec", "blockdec", "mount", "hash window"
+};
+
+#define ARENA_TOTAL (ALIGN_UP(ARENA_FEC_SIZE)+ \
+					ALIGN_UP(ARENA_BLOCKDEC_SIZE)+ALIGN_UP(ARENA_MOUNT_SIZE)+ALIGN_UP(ARENA_HASH_WINDOW_SIZE))
+
+static uint8_t arenaMem[ARENA_TOTAL] __attribute__((aligned(8)));
+static ArenaStats stats[ARENA_NO_POOLS];
+
+static uint8_t *poolStart(ArenaPool pool) {
+	size_t off=0;
+	for (int i=0; i<pool; i++) off+=poolSize[i];
+	return &arenaMem[off];
+}
+
+void *arenaAlloc(ArenaPool pool, size_t size) {
+	ArenaStats *st=&stats[pool];
+	size=ALIGN_UP(size);
+	if (st->used+size>poolSize[pool]) {
+		printf("arena: %s pool can't fit %d more bytes (%d of %d used)\n", poolName[pool], (int)size, (int)st->used, (int)poolSize[pool]);
+		st->fails++;
+		return NULL;
+	}
+	void *ret=poolStart(pool)+st->used;
+	st->used+=size;
+	if (st->used>st->peak) st->peak=st->used;
+	return ret;
+}
+
+void *arenaCalloc(ArenaPool pool, size_t size) {
+	void *ret=arenaAlloc(pool, size);
+	if (ret) memset(ret, 0, size);
+	return ret;
+}
+
+void arenaReset(ArenaPool pool) {
+	stats[pool].used=0;
+}
+
+void arenaGetStats(ArenaPool pool, ArenaStats *st) {
+	memcpy(st, &stats[pool], sizeof(ArenaStats));
+	st->size=poolSize[pool];
+}
+
+void arenaDumpStats() {
+	for (int i=0; i<ARENA_NO_POOLS; i++) {
+		printf("arena %-12s: %6d of %6d bytes used, peak %6d, %d failed\n", poolName[i],
+				(int)stats[i].used, (int)poolSize[i], (int)stats[i].peak, stats[i].fails);
+	}
+}
@@ -0,0 +1,85 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+/*
+Receiver memory plan.
+
+Everything the receive pipeline needs while running comes out of one statically allocated block,
+split into a pool per subsystem. The pools are sized at compile time from the largest FEC
+parameters and block devices we want to handle, so a fragmented heap can't make decoding fail
+halfway a stream. Allocation is a pointer bump; a pool is given back all at once, when its owner
+sets up anew (e.g. the FEC parameters change). Every pool is only used from one task.
+
+Override the ARENA_MAX_* defines from CFLAGS to trade memory against the streams a badge accepts.
+With the defaults the pools take about 85 KB.
+
+The FEC pool is what limits the streams we can decode. Every decoder fits a k up to ARENA_MAX_K;
+the ones that need less memory per k (LT, the systematic ones, defec_rs_prog) fit a bit more. A
+stream that doesn't fit is refused: defec prints that it couldn't initialize the decoder, and
+skips the stream. Before the arena the RS decoders took whatever k the heap allowed, and LT went
+up to 64, so such streams used to decode and no longer do. De-interleaving shares the FEC pool
+and gets what the decoder leaves: with the defaults, a stream with k=4 can go 8 deep.
+*/
+
+#include <stddef.h>
+
+//Largest FEC k the decoders get memory for.
+#ifndef ARENA_MAX_K
+#define ARENA_MAX_K 16
+#endif
+//Largest packet on the air, and what defecInit is told to expect. The server sends 1024 byte
+//packets; the FEC payload in them is a bit less.
+#ifndef ARENA_MAX_PACKET
+#define ARENA_MAX_PACKET 1024
+#endif
+//Block devices, and blocks in the largest of them.
+#ifndef ARENA_MAX_BLOCKDEVS
+#define ARENA_MAX_BLOCKDEVS 2
+#endif
+#ifndef ARENA_MAX_DEV_BLOCKS
+#define ARENA_MAX_DEV_BLOCKS 4096
+#endif
+//Block devices that can be mounted as FAT at the same time.
+#ifndef ARENA_MAX_MOUNTS
+#define ARENA_MAX_MOUNTS 2
+#endif
+//Bytes of hashed packets chksign can hold until their hash list comes by: a full list of
+//packets, plus a few. 0 if hash-chained streams don't need to be accepted.
+#ifndef ARENA_MAX_HASH_WINDOW
+#define ARENA_MAX_HASH_WINDOW ((HASHLIST_MAX_HASHES+4)*ARENA_MAX_PACKET)	//HASHLIST_MAX_HASHES is in structs.h
+#endif
+
+typedef enum {
+	ARENA_FEC=0,		//the current FEC decoder and de-interleaving buffer; given back on every parameter change
+	ARENA_BLOCKDEC,		//blockdecode and blkidcache state, for the lifetime of the program
+	ARENA_MOUNT,		//mountbd sector buffers
+	ARENA_HASH_WINDOW,	//chksign hashed packets waiting for their list, for the lifetime of the program
+	ARENA_NO_POOLS
+} ArenaPool;
+
+//Worst case is defec_rs: k received plus k decoded packets, and a cache of 16 inverted k*k
+//matrices of 16-bit words with their keys (see gbf_decoder_mem). The systematic decoders need
+//k data plus at most k parity packets. Plus some bookkeeping.
+#define ARENA_FEC_SIZE (ARENA_MAX_K*ARENA_MAX_PACKET*2+16*2*ARENA_MAX_K*(ARENA_MAX_K+1)+1024)
+//Handles, plus six bitmaps of a bit per block for the multi-level id cache.
+#define ARENA_BLOCKDEC_SIZE (ARENA_MAX_BLOCKDEVS*(512+6*(64+ARENA_MAX_DEV_BLOCKS/4)))
+#define ARENA_MOUNT_SIZE (ARENA_MAX_MOUNTS*BLOCKDEV_BLKSZ)	//BLOCKDEV_BLKSZ is in structs.h
+#define ARENA_HASH_WINDOW_SIZE ARENA_MAX_HASH_WINDOW
+
+typedef struct {
+	size_t size;		//budget
+	size_t used;		//currently handed out
+	size_t peak;		//most that was ever handed out at once
+	int fails;			//allocations that didn't fit
+} ArenaStats;
+
+//Returns 8-byte aligned memory, or NULL if the pool's budget is used up.
+void *arenaAlloc(ArenaPool pool, size_t size);
+//Same, zeroed.
+void *arenaCalloc(ArenaPool pool, size_t size);
+//Give back everything allocated from the pool.
+void arenaReset(ArenaPool pool);
+void arenaGetStats(ArenaPool pool, ArenaStats *st);
+void arenaDumpStats();
+
+#endif
@@ -8,6 +8,7 @@ that changeid. Delegates to the underlying block device for everything else.
 #include <string.h>
 #include "blkidcache.h"
 #include "bma.h"
+#include "arena.h"
 
 #define LEVELS 5
 
@@ -30,15 +31,18 @@ static void initCache(int blockno, uint32_t changeId, void *arg) {
 }
 
 BlkIdCacheHandle *idcacheCreate(int size, BlockdevifHandle *blkdev, BlockdevIf *bdif) {
-	BlkIdCacheHandle *ret=malloc(sizeof(BlkIdCacheHandle));
+	BlkIdCacheHandle *ret=arenaAlloc(ARENA_BLOCKDEC, sizeof(BlkIdCacheHandle));
+	if (ret==NULL) return NULL;
 	ret->blkdev=blkdev;
 	ret->size=size;
 	ret->bdif=bdif;
 	for (int i=0; i<LEVELS; i++) {
-		ret->bmp[i]=bmaCreate(size);
+		ret->bmp[i]=bmaInit(arenaAlloc(ARENA_BLOCKDEC, bmaSize(size)), size);
+		if (ret->bmp[i]==NULL) return NULL;
 		ret->id[i]=0;
 	}
-	ret->chidFlushed=bmaCreate(size);
+	ret->chidFlushed=bmaInit(arenaAlloc(ARENA_BLOCKDEC, bmaSize(size)), size);
+	if (ret->chidFlushed==NULL) return NULL;
 	bmaSetAll(ret->chidFlushed, 1);
 	printf("blkidcache_mlvl: reading all block IDs\n");
 	bdif->forEachBlock(blkdev, initCache, ret);
@@ -8,6 +8,7 @@ WARNING: Deprecated. If anything, does not honour bdif->notifyComplete.
 #include <stdint.h>
 #include <stdlib.h>
 #include "blkidcache.h"
+#include "arena.h"
 
 struct BlkIdCacheHandle {
 	BlockdevifHandle *blkdev;
@@ -15,7 +16,8 @@ struct BlkIdCacheHandle {
 };
 
 BlkIdCacheHandle *idcacheCreate(int size, BlockdevifHandle *blkdev, BlockdevIf *bdif) {
-	BlkIdCacheHandle *ret=malloc(sizeof(BlkIdCacheHandle));
+	BlkIdCacheHandle *ret=arenaAlloc(ARENA_BLOCKDEC, sizeof(BlkIdCacheHandle));
+	if (ret==NULL) return NULL;
 	ret->blkdev=blkdev;
 	ret->bdif=bdif;
 	return ret;
@@ -9,6 +9,7 @@
 #include "blockdecode.h"
 #include "blkidcache.h"
 #include "powerdown.h"
+#include "arena.h"
 
 #define ST_WAIT_CATALOG 0
 #define ST_WAIT_OLD 1
@@ -183,27 +184,42 @@ static void blockdecodeRecv(int subtype, uint8_t *data, int len, void *arg) {
 	}
 }
 
+//Called for stripes of change packets, before they're checked or decoded. We only want those if
+//they have a sector we don't have the current version of yet.
+static int blockdecodeWants(int secFirst, int secLast, void *arg) {
+	BlockDecodeHandle *d=(BlockDecodeHandle*)arg;
+	if (d->currentChangeID==0) return 1; //let blockdecodeRecv decide to go to sleep
+	if (d->state==ST_WAIT_CATALOG) return 0;
+	if (secLast>=d->noBlocks) secLast=d->noBlocks-1;
+	for (int i=secFirst; i<=secLast; i++) {
+		if (idcacheGet(d->idcache, i)!=d->currentChangeID) return 1;
+	}
+	return 0;
+}
+
 BlockDecodeHandle *blockdecodeInit(int type, int size, BlockdevIf *bdIf, void *bdevdesc) {
-	BlockDecodeHandle *d=malloc(sizeof(BlockDecodeHandle));
+	BlockDecodeHandle *d=arenaCalloc(ARENA_BLOCKDEC, sizeof(BlockDecodeHandle));
 	if (d==NULL) {
 		return NULL;
 	}
-	memset(d, 0, sizeof(BlockDecodeHandle));
 	d->bdev=bdIf->init(bdevdesc, size);
 	if (d->bdev==NULL) {
-		free(d);
 		return 0;
 	}
 	d->state=ST_WAIT_CATALOG;
 	d->noBlocks=size/BLOCKDEV_BLKSZ;
 	d->idcache=idcacheCreate(d->noBlocks, d->bdev, bdIf);
+	if (d->idcache==NULL) {
+		printf("Blockdecode: no memory for the block id cache\n");
+		return NULL;
+	}
 	d->bdif=bdIf;
 	d->currentChangeID=idcacheGetLastChangeId(d->idcache);
 
 
 	powerHold((int)d, 30*1000);
 
-	hldemuxAddType(type, blockdecodeRecv, d);
+	hldemuxAddTypeInterest(type, blockdecodeRecv, blockdecodeWants, d);
 
 	return d;
 }
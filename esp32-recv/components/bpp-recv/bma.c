@@ -9,13 +9,21 @@ struct Bma {
 };
 
 
-Bma *bmaCreate(int len) {
-	Bma *ret=malloc(sizeof(Bma)+(((len+31)/32))*8);
+size_t bmaSize(int len) {
+	return sizeof(Bma)+(((len+31)/32))*8;
+}
+
+Bma *bmaInit(void *mem, int len) {
+	Bma *ret=(Bma*)mem;
 	if (!ret) return NULL;
 	ret->len=len;
 	return ret;
 }
 
+Bma *bmaCreate(int len) {
+	return bmaInit(malloc(bmaSize(len)), len);
+}
+
 void bmaFree(Bma *b) {
 	free(b);
 }
@@ -7,10 +7,14 @@ doing this manually every time is too error-prone...
 
 #include <stdint.h>
 #include <stdbool.h>
+#include <stddef.h>
 
 typedef struct Bma Bma;
 
 Bma *bmaCreate(int len);
+//Same, but in bmaSize(len) bytes of memory the caller provides. Don't bmaFree() it.
+size_t bmaSize(int len);
+Bma *bmaInit(void *mem, int len);
 void bmaSet(Bma *b, int bit, int val);
 void bmaSetAll(Bma *b, int val);
 bool bmaIsSet(Bma *b, int bit);
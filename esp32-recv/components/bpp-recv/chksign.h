@@ -4,7 +4,17 @@
 #include "recvif.h"
 
 
+//chksignRecv() results
+#define CHKSIGN_FAIL 0		//bad signature, or a hashed packet too big to hold
+#define CHKSIGN_OK 1		//signature checked out
+#define CHKSIGN_PENDING 2	//hashed packet; held until a signed hash list vouches for it
+#define CHKSIGN_SKIPPED 3	//the filter said the packet isn't needed; not checked
+
+//Gets the payload of a packet before its signature is checked. Return 0 to drop it unchecked.
+typedef int (ChksignFilterCb)(uint8_t *packet, size_t len);
+
 void chksignInit(RecvCb *cb);
+void chksignSetFilter(ChksignFilterCb *cb);
 int chksignRecv(uint8_t *packet, size_t len);
 
 #endif
\ No newline at end of file
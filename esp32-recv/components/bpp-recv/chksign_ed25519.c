@@ -2,6 +2,14 @@
 Packet signature checking
 
 Every packet sent out is signed using ECDSA. We check that signature using the micro-ecc library.
+
+Alternatively, the server can send hashed packets (see structs.h) that only get authenticated by
+a signed hash list sent after them. Those are held in a small window until the list arrives. The
+packets themselves are stored back to back in a ring of bytes from the arena, so short packets
+only take the room they need.
+
+Checking a signature is the most expensive thing we do per packet, so a filter can have a look
+at the (not yet authenticated) payload first and drop packets we aren't going to need anyway.
 */
 #include <stdint.h>
 #include <stdlib.h>
@@ -10,27 +18,165 @@ Every packet sent out is signed using ECDSA. We check that signature using the m
 #include <arpa/inet.h>
 #include "recvif.h"
 #include "structs.h"
+#include "chksign.h"
+#include "arena.h"
 
 #include "ed25519.h"
+#include "sha512.h"
 #include "pubkey.inc"
+#include "pubkey_precomp.inc"
+
+//Hashed packets we can hold while waiting for their hash list. Should be a bit more than
+//HASHLIST_MAX_HASHES.
+#ifndef CHKSIGN_HASH_WINDOW
+#define CHKSIGN_HASH_WINDOW (HASHLIST_MAX_HASHES+4)
+#endif
+
+typedef struct {
+	uint8_t hash[HASHLIST_HASH_LEN];
+	int ok;
+	size_t len;
+	uint8_t *data; //entire packet, including the magic; points into winMem
+} PendingPacket;
+
+static PendingPacket window[CHKSIGN_HASH_WINDOW];
+static int winFirst, winCount; //ring; winFirst is the oldest
+static uint8_t *winMem;
+static size_t winMemSize;
+static size_t winMemWrite; //where the data of the next packet goes, if it fits
+
+//The server sends every hash list twice; remember the last one we verified so the copy can be
+//recognized without verifying it again.
+#define CHKSIGN_MAX_LIST (sizeof(SignedPacket)+sizeof(HashListPacket)+HASHLIST_MAX_HASHES*HASHLIST_HASH_LEN)
+static uint8_t lastList[CHKSIGN_MAX_LIST];
+static size_t lastListLen;
 
 static RecvCb *recvCb;
+static ChksignFilterCb *filterCb;
 
 void chksignInit(RecvCb *cb) {
 	recvCb=cb;
+	winMem=arenaAlloc(ARENA_HASH_WINDOW, ARENA_HASH_WINDOW_SIZE);
+	winMemSize=winMem?ARENA_HASH_WINDOW_SIZE:0;
 }
 
-int chksignRecv(uint8_t *packet, size_t len) {
-	if (len<sizeof(SignedPacket)) return;
+void chksignSetFilter(ChksignFilterCb *cb) {
+	filterCb=cb;
+}
+
+//Plain per-packet signature. Returns 1 if ok, after passing the packet on.
+static int checkSigned(uint8_t *packet, size_t len, int allowHashList);
+
+//A hashed packet that no list vouched for. It may still be a normal signed packet whose
+//signature happens to start with HASHED_MAGIC, so try that before giving up.
+static void dropPending(PendingPacket *p) {
+	if (!checkSigned(p->data, p->len, 0)) {
+		printf("Chksign: hashed packet not in any hash list; dropped.\n");
+	}
+}
+
+//Where in winMem len more bytes can go, or NULL if the packets held now are in the way.
+static uint8_t *winMemFind(size_t len) {
+	if (winCount==0) winMemWrite=0;
+	size_t oldest=winCount?window[winFirst].data-winMem:winMemSize;
+	if (winMemWrite>oldest || winCount==0) {
+		//Free space is from the write position to the end, and from the start to the oldest.
+		if (winMemWrite+len<=winMemSize) return winMem+winMemWrite;
+		if (len<=oldest) return winMem;
+	} else if (winMemWrite+len<=oldest) {
+		return winMem+winMemWrite;
+	}
+	return NULL;
+}
+
+//Returns CHKSIGN_PENDING, or CHKSIGN_FAIL if the packet can never fit in the window.
+static int recvHashed(uint8_t *packet, size_t len) {
+	if (len>winMemSize) return CHKSIGN_FAIL;
+	uint8_t *data;
+	while ((winCount==CHKSIGN_HASH_WINDOW) || (data=winMemFind(len))==NULL) {
+		//Window full: the list for the oldest one got lost.
+		dropPending(&window[winFirst]);
+		winFirst=(winFirst+1)%CHKSIGN_HASH_WINDOW;
+		winCount--;
+	}
+	PendingPacket *p=&window[(winFirst+winCount)%CHKSIGN_HASH_WINDOW];
+	uint8_t hash[64];
+	sha512(packet+sizeof(HashedPacket), len-sizeof(HashedPacket), hash);
+	memcpy(p->hash, hash, HASHLIST_HASH_LEN);
+	memcpy(data, packet, len);
+	p->data=data;
+	p->len=len;
+	p->ok=0;
+	winMemWrite=data-winMem+len;
+	winCount++;
+	return CHKSIGN_PENDING;
+}
+
+static void recvHashList(HashListPacket *hl, size_t len) {
+	if (len<sizeof(HashListPacket) || len<sizeof(HashListPacket)+hl->count*HASHLIST_HASH_LEN) return;
+	//Mark everything the list vouches for, and remember the newest one.
+	int last=-1;
+	for (int i=0; i<winCount; i++) {
+		PendingPacket *p=&window[(winFirst+i)%CHKSIGN_HASH_WINDOW];
+		for (int j=0; j<hl->count; j++) {
+			if (memcmp(p->hash, hl->hash[j], HASHLIST_HASH_LEN)==0) {
+				p->ok=1;
+				last=i;
+				break;
+			}
+		}
+	}
+	//Pass on everything up to the newest packet in the list, in order. Anything older that
+	//is not in the list isn't going to be vouched for anymore.
+	for (int i=0; i<=last; i++) {
+		PendingPacket *p=&window[winFirst];
+		if (p->ok) {
+			recvCb(p->data+sizeof(HashedPacket), p->len-sizeof(HashedPacket));
+		} else {
+			dropPending(p);
+		}
+		winFirst=(winFirst+1)%CHKSIGN_HASH_WINDOW;
+		winCount--;
+	}
+}
+
+static int checkSigned(uint8_t *packet, size_t len, int allowHashList) {
+	if (len<sizeof(SignedPacket)) return 0;
 	SignedPacket *p=(SignedPacket*)packet;
 	int plLen=len-sizeof(SignedPacket);
 
-	//Check signature of packet
-	int isOk=ed25519_verify(p->sig, p->data, plLen, public_key);
-	if (isOk) {
-		recvCb(p->data, plLen);
+	//Check signature of packet. We only ever check against our own key, so use the tables
+	//precomputed for it.
+	int isOk=ed25519_verify_precomp(p->sig, p->data, plLen, public_key, public_key_precomp, ED25519_PRECOMP_WINDOW);
+	if (!isOk) return 0;
+	if (plLen>=sizeof(HashListPacket) && ntohl(((HashListPacket*)p->data)->magic)==HASHLIST_MAGIC) {
+		//Not while walking the window for another list, though.
+		if (allowHashList) {
+			lastListLen=(len<=sizeof(lastList))?len:0;
+			memcpy(lastList, packet, lastListLen);
+			recvHashList((HashListPacket*)p->data, plLen);
+		}
 	} else {
-		printf("Signature check failed.\n");
+		recvCb(p->data, plLen);
+	}
+	return 1;
+}
+
+int chksignRecv(uint8_t *packet, size_t len) {
+	if (len>=sizeof(HashedPacket) && ntohl(((HashedPacket*)packet)->magic)==HASHED_MAGIC) {
+		if (filterCb && !filterCb(packet+sizeof(HashedPacket), len-sizeof(HashedPacket))) return CHKSIGN_SKIPPED;
+		return recvHashed(packet, len);
+	}
+	//Byte for byte the list we just verified: already handled this one.
+	if (lastListLen && len==lastListLen && memcmp(packet, lastList, len)==0) return CHKSIGN_OK;
+	if (filterCb && len>=sizeof(SignedPacket)+sizeof(uint32_t)) {
+		//Hash lists don't belong to the layer above; never filter those.
+		uint8_t *pl=packet+sizeof(SignedPacket);
+		if (ntohl(((HashListPacket*)pl)->magic)!=HASHLIST_MAGIC && !filterCb(pl, len-sizeof(SignedPacket))) {
+			return CHKSIGN_SKIPPED;
+		}
 	}
-	return isOk;
+	if (checkSigned(packet, len, 1)) return CHKSIGN_OK;
+	printf("Signature check failed.\n");
+	return CHKSIGN_FAIL;
 }
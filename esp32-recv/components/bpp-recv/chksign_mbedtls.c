@@ -10,6 +10,7 @@ Every packet sent out is signed using ECDSA/SHA256. We check it using MbedTLS fu
 #include <arpa/inet.h>
 #include "recvif.h"
 #include "structs.h"
+#include "chksign.h"
 #include "mbedtls/config.h"
 #include "mbedtls/entropy.h"
 #include "mbedtls/ctr_drbg.h"
@@ -19,6 +20,7 @@ Every packet sent out is signed using ECDSA/SHA256. We check it using MbedTLS fu
 #include "mbedtls/sha256.h"
 
 static RecvCb *recvCb;
+static ChksignFilterCb *filterCb;
 
 //We only use the key as a handy store for Q and grp; obviously we do not have the 
 //private key here.
@@ -46,10 +48,15 @@ void chksignInit(RecvCb *cb) {
 	if (r) printf("read_binary Z failed\n");
 }
 
-void chksignRecv(uint8_t *packet, size_t len) {
-	if (len<sizeof(SignedPacket)) return;
+void chksignSetFilter(ChksignFilterCb *cb) {
+	filterCb=cb;
+}
+
+int chksignRecv(uint8_t *packet, size_t len) {
+	if (len<sizeof(SignedPacket)) return CHKSIGN_FAIL;
 	SignedPacket *p=(SignedPacket*)packet;
 	int plLen=len-sizeof(SignedPacket);
+	if (filterCb && !filterCb(p->data, plLen)) return CHKSIGN_SKIPPED;
 
 	uint8_t hash[32];
 	mbedtls_sha256(p->data, plLen, hash, 0);
@@ -61,9 +68,10 @@ void chksignRecv(uint8_t *packet, size_t len) {
 	mbedtls_mpi_read_binary(&mpis, (unsigned char*)&p->sig[32], 32);
 	int isOk=!mbedtls_ecdsa_verify(&key.grp, hash, sizeof(hash), &key.Q, &mpir, &mpis);
 
-	if (isOk) {
-		recvCb(p->data, plLen);
-	} else {
+	if (!isOk) {
 		printf("Huh? ECDSA signature mismatch!\n");
+		return CHKSIGN_FAIL;
 	}
+	recvCb(p->data, plLen);
+	return CHKSIGN_OK;
 }
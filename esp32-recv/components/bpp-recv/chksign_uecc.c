@@ -10,21 +10,28 @@ Every packet sent out is signed using ECDSA. We check that signature using the m
 #include <arpa/inet.h>
 #include "recvif.h"
 #include "structs.h"
+#include "chksign.h"
 
 #include "uECC.h"
 #include "../keys/pubkey.inc"
 #include "sha256.h"
 
 static RecvCb *recvCb;
+static ChksignFilterCb *filterCb;
 
 void chksignInit(RecvCb *cb) {
 	recvCb=cb;
 }
 
-void chksignRecv(uint8_t *packet, size_t len) {
-	if (len<sizeof(SignedPacket)) return;
+void chksignSetFilter(ChksignFilterCb *cb) {
+	filterCb=cb;
+}
+
+int chksignRecv(uint8_t *packet, size_t len) {
+	if (len<sizeof(SignedPacket)) return CHKSIGN_FAIL;
 	SignedPacket *p=(SignedPacket*)packet;
 	int plLen=len-sizeof(SignedPacket);
+	if (filterCb && !filterCb(p->data, plLen)) return CHKSIGN_SKIPPED;
 
 	SHA256_CTX sha;
 	uint8_t hash[32];
@@ -36,7 +43,7 @@ void chksignRecv(uint8_t *packet, size_t len) {
 	//Check signature of packet
 	int isOk=uECC_verify(public_key, hash, sizeof(hash), p->sig, uECC_secp256r1());
 	
-	if (isOk) {
-		recvCb(p->data, plLen);
-	}
+	if (!isOk) return CHKSIGN_FAIL;
+	recvCb(p->data, plLen);
+	return CHKSIGN_OK;
 }
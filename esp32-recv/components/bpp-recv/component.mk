@@ -3,10 +3,14 @@
 #
 
 
+#RS decoder: defec_rs_prog (progressive) or defec_rs (whole stripe at once, with the inverse
+#matrix cache). Set BPP_DEFEC_RS when running make to change it.
+BPP_DEFEC_RS ?= defec_rs_prog
+
 COMPONENT_ADD_INCLUDEDIRS := . common
 COMPONENT_SOURCES := . common
 COMPONENT_OBJS := bd_flatflash.o blkidcache_mlvl.o blockdecode.o chksign_ed25519.o defec.o hkpackets.o \
-					hldemux.o powerdown.o serdec.o subtitle.o crc16-ccitt.o defec_parity.o defec_rs.o \
-					bd_ropart.o mountbd.o bma.o
+					hldemux.o powerdown.o serdec.o subtitle.o crc16-ccitt.o defec_parity.o $(BPP_DEFEC_RS).o defec_rs_sys.o defec_lt.o \
+					bd_ropart.o mountbd.o bma.o arena.o
 
 
@@ -5,25 +5,33 @@ Try to ressurect missing packets using FEC
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <stddef.h>
 #include <arpa/inet.h>
 #include <freertos/portmacro.h>
 #include "recvif.h"
 #include "structs.h"
 #include "defec.h"
 #include "esp_attr.h"
+#include "arena.h"
 
 
 extern const FecDecoder fecDecoderParity;
 extern const FecDecoder fecDecoderRs;
+extern const FecDecoder fecDecoderRsSys;
+extern const FecDecoder fecDecoderCrs;
+extern const FecDecoder fecDecoderLt;
 
 static const FecDecoder *decoders[]={
 	&fecDecoderParity,
 	&fecDecoderRs,
+	&fecDecoderRsSys,
+	&fecDecoderCrs,
+	&fecDecoderLt,
 	NULL
 };
 
 typedef struct {
-	int k, n, algId;
+	int k, n, algId, depth;
 } FecSavedStatus;
 
 static RTC_DATA_ATTR FecSavedStatus savedStatus;
@@ -36,6 +44,47 @@ static portMUX_TYPE statusMux = portMUX_INITIALIZER_UNLOCKED;
 static FecStatus status;
 static int lastRecvSerial;
 
+//Serials stripe descriptors told us nobody needs. Back-to-back skipped stripes add up to one
+//range, so decoders can tell a run of them apart from a real gap.
+static InterestCb *interestCb;
+static uint32_t skipFirst, skipEnd;
+
+//De-interleaving. A block of depth*n serials is collected here and then fed to the decoder
+//stripe by stripe. The RS-style decoders never need more than k packets of a stripe, so that's
+//all we keep for them; LT needs a few more than k, so it gets the whole stripe. The buffer
+//comes out of the arena's FEC pool, after the decoder, so how deep we can go depends on how
+//much the decoder leaves: the smaller k, the deeper.
+static int ilDepth=1;
+static int ilKeep;				//packets kept per stripe
+static uint8_t *ilData;			//depth*ilKeep packets of maxPacketSize
+static int *ilSerial;			//serial of every stored packet
+static int *ilLen;
+static uint8_t *ilCount;		//packets stored per stripe
+static int ilBlock=-1;			//first serial of the block in the buffer
+
+//The memory goes back with the rest of the FEC pool.
+static void ilFree() {
+	ilData=NULL; ilSerial=NULL; ilLen=NULL; ilCount=NULL;
+	ilDepth=1;
+}
+
+static int ilAlloc(int depth) {
+	ilFree();
+	if (depth<=1) return 1;
+	ilKeep=(currDecoder && currDecoder->algId==FEC_ID_LT)?currN:currK;
+	ilData=arenaAlloc(ARENA_FEC, depth*ilKeep*maxPacketSize);
+	ilSerial=arenaAlloc(ARENA_FEC, depth*ilKeep*sizeof(int));
+	ilLen=arenaAlloc(ARENA_FEC, depth*ilKeep*sizeof(int));
+	ilCount=arenaCalloc(ARENA_FEC, depth);
+	if (!ilData || !ilSerial || !ilLen || !ilCount) {
+		ilFree();
+		return 0;
+	}
+	ilDepth=depth;
+	ilBlock=-1;
+	return 1;
+}
+
 void defecInit(RecvCb *cb, int maxLen) {
 	currDecoder=decoders[0];
 	currK=3;
@@ -52,7 +101,14 @@ void defecInit(RecvCb *cb, int maxLen) {
 		}
 		currDecoder=decoders[i];
 	}
-	currDecoder->init(currK, currN, maxLen);
+	arenaReset(ARENA_FEC);
+	if (currDecoder==NULL || !currDecoder->init(currK, currN, maxLen)) {
+		//E.g. a k that doesn't fit the arena. Wait for the next FecDesc.
+		printf("FEC: Can't restore decoder for k=%d n=%d!\n", currK, currN);
+		currDecoder=NULL;
+		return;
+	}
+	if (!ilAlloc(savedStatus.depth)) printf("FEC: Can't de-interleave %d deep!\n", savedStatus.depth);
 }
 
 void defecGetStatus(FecStatus *st) {
@@ -61,10 +117,94 @@ void defecGetStatus(FecStatus *st) {
 	portEXIT_CRITICAL(&statusMux);
 }
 
+void defecCountInvCache(int hits, int misses) {
+	portENTER_CRITICAL(&statusMux);
+	status.invCacheHits+=hits;
+	status.invCacheMisses+=misses;
+	portEXIT_CRITICAL(&statusMux);
+}
+
+void defecSetInterestCb(InterestCb *cb) {
+	interestCb=cb;
+}
+
+//Keep the receive statistics for a new serial. Returns 0 if it's a dup.
+static int countSerial(int serial) {
+	if (serial<=lastRecvSerial) return 0;
+	if (lastRecvSerial!=0) {
+		portENTER_CRITICAL(&statusMux);
+		status.packetsInTotal+=serial-lastRecvSerial;
+		status.packetsInMissed+=(serial-lastRecvSerial)-1;
+		portEXIT_CRITICAL(&statusMux);
+	}
+	lastRecvSerial=serial;
+	return 1;
+}
+
+static void recvStripeDesc(StripeDesc *d) {
+	int type=ntohs(d->type);
+	if (type==STRIPEDESC_TYPE_ANY || interestCb==NULL) return;
+	if (interestCb(type, ntohs(d->secFirst), ntohs(d->secLast))) return;
+	uint32_t first=ntohl(d->firstSerial);
+	if (first<skipFirst || first>skipEnd) skipFirst=first;
+	skipEnd=first+ntohs(d->count);
+}
+
+int defecSkipped(int first, int end) {
+	return first>=(int)skipFirst && end<=(int)skipEnd;
+}
+
+int defecWants(uint8_t *packet, size_t len) {
+	if (len<sizeof(FecPacket)) return 1;
+	uint32_t serial=ntohl(((FecPacket*)packet)->serial);
+	if (serial<skipFirst || serial>=skipEnd) return 1;
+	//As far as reception goes, we did get it.
+	if (countSerial(serial)) {
+		portENTER_CRITICAL(&statusMux);
+		status.packetsSkipped++;
+		portEXIT_CRITICAL(&statusMux);
+	}
+	return 0;
+}
+
 static void defecRecvDefecced(uint8_t *packet, size_t len) {
 	recvCb(packet, len);
 }
 
+//Feed everything we have of the current block to the decoder, in original order.
+static void ilFlush() {
+	for (int s=0; s<ilDepth; s++) {
+		for (int i=0; i<ilCount[s]; i++) {
+			int e=s*ilKeep+i;
+			currDecoder->recv(&ilData[e*maxPacketSize], ilLen[e], ilSerial[e], defecRecvDefecced);
+		}
+		ilCount[s]=0;
+	}
+}
+
+static void ilRecv(uint8_t *packet, size_t len, int serial) {
+	int blockLen=ilDepth*currN;
+	int airSlot=serial%blockLen;
+	int block=serial-airSlot;
+	if (block!=ilBlock) {
+		if (ilBlock>=0) ilFlush();
+		ilBlock=block;
+	}
+	int s=airSlot%ilDepth;
+	if (ilCount[s]<ilKeep && len<=maxPacketSize) {
+		int e=s*ilKeep+ilCount[s];
+		memcpy(&ilData[e*maxPacketSize], packet, len);
+		ilLen[e]=len;
+		ilSerial[e]=block+s*currN+airSlot/ilDepth;
+		ilCount[s]++;
+	}
+	//Last packet of the block; no need to wait for the next one.
+	if (airSlot==blockLen-1) {
+		ilFlush();
+		ilBlock=-1;
+	}
+}
+
 
 void defecRecv(uint8_t *packet, size_t len) {
 	if (len<sizeof(FecPacket)) return;
@@ -72,22 +212,30 @@ void defecRecv(uint8_t *packet, size_t len) {
 	int plLen=len-sizeof(FecPacket);
 
 	int serial=ntohl(p->serial);
+	if ((uint32_t)serial==FEC_SERIAL_STRIPEDESC) {
+		if (plLen>=sizeof(StripeDesc)) recvStripeDesc((StripeDesc*)p->data);
+		return;
+	}
 	if (serial==0) {
 		//Special packet: contains fec parameters
-		if (plLen<sizeof(FecDesc)) return;
+		if (plLen<offsetof(FecDesc, interleave)) return;
 		FecDesc *d=(FecDesc*)p->data;
+		int depth=(plLen>=sizeof(FecDesc) && d->interleave>1)?d->interleave:1;
 		if (currDecoder==NULL || \
 				currDecoder->algId!=d->fecAlgoId || \
 				currK!=ntohs(d->k) || \
-				currN!=ntohs(d->n)) {
+				currN!=ntohs(d->n) || \
+				ilDepth!=depth) {
 			//Fec parameters changed. Close current decoder, open new one.
 			if (currDecoder) currDecoder->deinit();
+			arenaReset(ARENA_FEC);
 
 			currK=ntohs(d->k);
 			currN=ntohs(d->n);
 			savedStatus.k=currK;
 			savedStatus.n=currN;
 			savedStatus.algId=d->fecAlgoId;
+			savedStatus.depth=depth;
 			int i;
 			for (i=0; decoders[i]!=NULL; i++) {
 				if (decoders[i]->algId==d->fecAlgoId) break;
@@ -100,8 +248,12 @@ void defecRecv(uint8_t *packet, size_t len) {
 				if (!r) {
 					currDecoder=NULL;
 					printf("FEC: Couldn't initialize decoder id %d for k=%d n=%d!\n", d->fecAlgoId, currK, currN);
+				} else if (!ilAlloc(depth)) {
+					currDecoder->deinit();
+					currDecoder=NULL;
+					printf("FEC: Can't de-interleave %d deep with k=%d n=%d!\n", depth, currK, currN);
 				} else {
-					printf("FEC: Changed to decoder id %d, k=%d n=%d!\n", d->fecAlgoId, currK, currN);
+					printf("FEC: Changed to decoder id %d, k=%d n=%d, interleave %d!\n", d->fecAlgoId, currK, currN, depth);
 				}
 			}
 		}
@@ -109,15 +261,11 @@ void defecRecv(uint8_t *packet, size_t len) {
 	}
 	if (!currDecoder) return; //can't decode!
 
-	if (serial<=lastRecvSerial) return; //dup
+	if (!countSerial(serial)) return; //dup
 
-	if (lastRecvSerial!=0) {
-		portENTER_CRITICAL(&statusMux);
-		status.packetsInTotal+=serial-lastRecvSerial;
-		status.packetsInMissed+=(serial-lastRecvSerial)-1;
-		portEXIT_CRITICAL(&statusMux);
+	if (ilDepth>1) {
+		ilRecv(p->data, plLen, serial);
+	} else {
+		currDecoder->recv(p->data, plLen, serial, defecRecvDefecced);
 	}
-	lastRecvSerial=serial;
-
-	currDecoder->recv(p->data, plLen, serial, defecRecvDefecced);
 }
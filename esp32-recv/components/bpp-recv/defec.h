@@ -20,11 +20,23 @@ typedef struct {
 typedef struct {
 	int packetsInTotal;
 	int packetsInMissed;
+	int invCacheHits;		//stripes decoded with a cached inverse matrix (defec_rs only)
+	int invCacheMisses;		//stripes that needed a matrix inversion
+	int packetsSkipped;		//not needed according to a stripe descriptor; these count as received
 } FecStatus;
 
 
 void defecInit(RecvCb *cb, int maxLen);
 void defecRecv(uint8_t *packet, size_t len);
+void defecSetInterestCb(InterestCb *cb);
+//Returns 0 if a stripe descriptor said the layers above don't need this packet. Meant to be
+//called on packets that haven't been authenticated yet, so it only looks at the serial.
+int defecWants(uint8_t *packet, size_t len);
 void defecGetStatus(FecStatus *st);
+//For decoders to report how their inverse matrix cache is doing.
+void defecCountInvCache(int hits, int misses);
+//Returns 1 if serials first up to end weren't received because a stripe descriptor said they
+//weren't needed. Decoders use it to not report those as missed bins.
+int defecSkipped(int first, int end);
 
 #endif
\ No newline at end of file
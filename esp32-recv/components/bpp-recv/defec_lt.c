@@ -0,0 +1,106 @@
+/*
+LT fountain code decoding. Like the systematic RS decoder, data packets that come in in order
+are passed on straight away. Everything else goes into the LT decoder, which can rebuild the
+stripe out of any set of packets that spans it: usually k plus a few, from wherever in the
+stripe we started listening.
+*/
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <arpa/inet.h>
+#include "recvif.h"
+#include "structs.h"
+#include "defec.h"
+#include "lt.h"
+#include "arena.h"
+
+static lt_t lt;
+static lt_dec_t ltDec;
+static int ltK, ltN;
+static int maxPacketLen;
+static int curBin;
+static int curLen;
+static int nextOut;				//next data packet to pass on; k if the bin is done
+
+static int defecLtInit(int k, int n, int maxLen) {
+	if (n<=k) return 0;
+	//The decoder keeps up to k packets per stripe, in the FEC pool of the arena; its size
+	//(see ARENA_MAX_K) limits what we can do.
+	void *decMem=arenaAlloc(ARENA_FEC, lt_dec_mem(k, maxLen));
+	if (decMem==NULL) return 0;
+	if (!lt_init(&lt, k)) return 0;
+	if (!lt_dec_init(&ltDec, &lt, maxLen, decMem)) {
+		lt_free(&lt);
+		return 0;
+	}
+	ltK=k;
+	ltN=n;
+	maxPacketLen=maxLen;
+	curBin=-1;
+	curLen=0;
+	return 1;
+}
+
+static void defecLtDeinit() {
+	lt_dec_free(&ltDec);
+	lt_free(&lt);
+}
+
+//Pass on data packets in order, for as far as we have them. If giveUp is set, skip over the
+//holes, marking each of them with a NULL packet.
+static void sendData(int giveUp, FecSendDefeccedPacket sendFn) {
+	int inHole=0;
+	while (nextOut<ltK) {
+		const uint8_t *p=lt_dec_get(&ltDec, nextOut);
+		if (p) {
+			sendFn((uint8_t*)p, curLen);
+			inHole=0;
+		} else if (giveUp) {
+			if (!inHole) sendFn(NULL, 0);
+			inHole=1;
+		} else {
+			return;
+		}
+		nextOut++;
+	}
+}
+
+static void newBin(int bin, int len) {
+	curBin=bin;
+	curLen=len;
+	lt_dec_reset(&ltDec, len);
+	nextOut=0;
+}
+
+static void defecLtRecv(uint8_t *packet, size_t len, int serial, FecSendDefeccedPacket sendFn) {
+	int bin=serial/ltN;
+	int esi=serial%ltN;
+	if (len>maxPacketLen) return;
+	if (bin!=curBin) {
+		if (curBin>=0) {
+			//Whatever we couldn't repair in the previous bin is lost.
+			if (nextOut<ltK) printf("defecLt: Couldn't repair bin.\n");
+			sendData(1, sendFn);
+			if (bin!=curBin+1) {
+				if (!defecSkipped((curBin+1)*ltN, bin*ltN)) printf("defecLt: Missed a bin.\n");
+				sendFn(NULL, 0);
+			}
+		}
+		newBin(bin, len);
+	}
+	if (nextOut==ltK) return; //bin is done; no need for more
+	if (curLen!=len) {
+		//shouldn't happen
+		printf("defecLt: packet length changed from %d to %d\n", curLen, (int)len);
+		newBin(bin, len);
+	}
+	if (lt_dec_add(&ltDec, esi, packet)) sendData(0, sendFn);
+}
+
+const FecDecoder fecDecoderLt={
+	.algId=FEC_ID_LT,
+	.init=defecLtInit,
+	.recv=defecLtRecv,
+	.deinit=defecLtDeinit
+};
@@ -9,6 +9,8 @@ Try to ressurect missing packets using the parity packet
 #include "recvif.h"
 #include "structs.h"
 #include "defec.h"
+#include "redundancy.h"
+#include "arena.h"
 
 static uint8_t **parPacket;
 static uint32_t *parSerial;
@@ -22,10 +24,12 @@ static int defecParInit(int k, int n, int maxLen) {
 	if (k!=n-1) return 0;
 	int i;
 	
-	parPacket=malloc(sizeof(uint8_t*)*k);
-	parSerial=malloc(sizeof(uint32_t)*k);
+	parPacket=arenaAlloc(ARENA_FEC, sizeof(uint8_t*)*k);
+	parSerial=arenaAlloc(ARENA_FEC, sizeof(uint32_t)*k);
+	if (!parPacket || !parSerial) return 0;
 	for (i=0; i<k; i++) {
-		parPacket[i]=malloc(maxLen);
+		parPacket[i]=arenaAlloc(ARENA_FEC, maxLen);
+		if (!parPacket[i]) return 0;
 		parSerial[i]=0;
 	}
 	defecK=k;
@@ -33,13 +37,6 @@ static int defecParInit(int k, int n, int maxLen) {
 }
 
 static void defecParDeinit() {
-	if (parPacket) {
-		for (int i=0; i<defecK; i++) {
-			free(parPacket[i]);
-		}
-	}
-	free(parPacket);
-	free(parSerial);
 	parPacket=NULL;
 	parSerial=NULL;
 }
@@ -120,11 +117,7 @@ static void defecParRecv(uint8_t *packet, size_t len, int serial, FecSendDefecce
 			//Xor the parity packet with the packets we have to magically allow the
 			//missing packet to appear
 			for (int i=0; i<defecK; i++) {
-				if (i!=missing) {
-					for (int j=0; j<len; j++) {
-						packet[j]^=parPacket[i][j];
-					}
-				}
+				if (i!=missing) gbf_xor_region(packet, parPacket[i], len);
 			}
 			//We expect at least the last datapacket in the prev seq as the last one sent.
 			int exSerial=serial-defecK-1;
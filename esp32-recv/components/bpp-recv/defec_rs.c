@@ -10,26 +10,33 @@ Try to ressurect missing packets using the parity packet
 #include "structs.h"
 #include "defec.h"
 #include "redundancy.h"
+#include "arena.h"
 
 static uint8_t *rsPacket;
+static uint8_t *rsOut;
 static gbf_int_t *rsSerial;
 static int curBin; // = serial/rsN
 static int recved;
 static int rsK, rsN;
 static int curLen;
+static int maxPacketLen;
 static int lastOkBin;
+static gbf_decoder_t rsDecoder;
+
+//Inverted matrices to keep around. With small k, this covers most loss patterns.
+#define RS_INV_CACHE_ENTRIES 16
 
 
 static int defecRsInit(int k, int n, int maxLen) {
-	rsPacket=malloc(maxLen*k);
-	rsSerial=malloc(sizeof(gbf_int_t)*k);
-	if (rsPacket==NULL || rsSerial==NULL) {
-		free(rsPacket);
-		free(rsSerial);
-		return 0;
-	}
+	rsPacket=arenaAlloc(ARENA_FEC, maxLen*k);
+	rsOut=arenaAlloc(ARENA_FEC, maxLen*k);
+	rsSerial=arenaAlloc(ARENA_FEC, sizeof(gbf_int_t)*k);
+	void *decMem=arenaAlloc(ARENA_FEC, gbf_decoder_mem(k, RS_INV_CACHE_ENTRIES));
+	if (rsPacket==NULL || rsOut==NULL || rsSerial==NULL || decMem==NULL) return 0;
+	if (!gbf_decoder_init(&rsDecoder, k, RS_INV_CACHE_ENTRIES, decMem)) return 0;
 	rsK=k;
 	rsN=n;
+	maxPacketLen=maxLen;
 	recved=0;
 	curLen=0;
 	lastOkBin=0;
@@ -38,26 +45,22 @@ static int defecRsInit(int k, int n, int maxLen) {
 }
 
 static void defecRsDeinit() {
-	free(rsPacket);
-	free(rsSerial);
 	rsPacket=NULL;
+	rsOut=NULL;
 	rsSerial=NULL;
+	gbf_decoder_free(&rsDecoder);
 }
 
 static int flushRsState(FecSendDefeccedPacket sendFn) {
 	int r=0;
 	if (recved>=rsK) {
-		uint8_t *out=malloc(rsK*curLen);
-		if (out!=NULL) {
-			gbf_decode((gbf_int_t*)out, (gbf_int_t*)rsPacket, rsSerial, rsK, (curLen/sizeof(gbf_int_t)));
-			for (int i=0; i<rsK; i++) {
-				sendFn(&out[i*curLen], curLen);
-			}
-			r=1;
-		} else {
-			printf("defecRs: can't allocate mem to decode packet!\n");
+		int hits=rsDecoder.hits, misses=rsDecoder.misses;
+		gbf_decode_ctx(&rsDecoder, (gbf_int_t*)rsOut, (gbf_int_t*)rsPacket, rsSerial, (curLen/sizeof(gbf_int_t)));
+		defecCountInvCache(rsDecoder.hits-hits, rsDecoder.misses-misses);
+		for (int i=0; i<rsK; i++) {
+			sendFn(&rsOut[i*curLen], curLen);
 		}
-		free(out);
+		r=1;
 	}
 	recved=0;
 	return r;
@@ -66,11 +69,12 @@ static int flushRsState(FecSendDefeccedPacket sendFn) {
 
 static void defecRsRecv(uint8_t *packet, size_t len, int serial, FecSendDefeccedPacket sendFn) {
 	int bin=serial/rsN;
+	if (len>maxPacketLen) return;
 	if (bin==lastOkBin) return; //already sent this.
 	if (bin!=curBin) {
 		//Did we miss a bin?
 		if (lastOkBin!=bin-1) {
-			printf("defecRs: Missed a bin.\n");
+			if (!defecSkipped((lastOkBin+1)*rsN, bin*rsN)) printf("defecRs: Missed a bin.\n");
 			sendFn(NULL, 0);
 		}
 		//See if we can send whatever we had from the prev bin and start anew.
@@ -0,0 +1,88 @@
+/*
+Reed-Solomon decoding, progressively. Same algorithm id and results as defec_rs.c, but every
+packet is worked into the decoder when it comes in, instead of doing the whole stripe in one go
+when the k'th packet arrives. That keeps the time spent per packet short and predictable, so the
+parse task doesn't stall while the sniffer keeps filling its buffer. The data goes out as soon as
+the stripe is complete. Use this or defec_rs.o (DEFEC_RS / BPP_DEFEC_RS in the makefiles); 'make
+bench' in redundancy/ shows the difference. Only defec_rs has the inverse matrix cache.
+*/
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <arpa/inet.h>
+#include "recvif.h"
+#include "structs.h"
+#include "defec.h"
+#include "redundancy.h"
+#include "arena.h"
+
+static gbf_prog_t rsProg;
+static uint8_t *rsOut;
+static int curBin; // = serial/rsN
+static int rsK, rsN;
+static int curLen;
+static int maxPacketLen;
+static int lastOkBin;
+
+
+static int defecRsInit(int k, int n, int maxLen) {
+	int words=maxLen/sizeof(gbf_int_t);
+	rsOut=arenaAlloc(ARENA_FEC, maxLen*k);
+	void *progMem=arenaAlloc(ARENA_FEC, gbf_prog_mem(k, words));
+	if (rsOut==NULL || progMem==NULL || !gbf_prog_init(&rsProg, k, words, progMem)) return 0;
+	rsK=k;
+	rsN=n;
+	maxPacketLen=maxLen;
+	curBin=-1;
+	curLen=0;
+	lastOkBin=0;
+	gbf_init(GBF_POLYNOME);
+	return 1;
+}
+
+static void defecRsDeinit() {
+	rsOut=NULL;
+	gbf_prog_free(&rsProg);
+}
+
+static void newBin(int bin, int len) {
+	curBin=bin;
+	curLen=len;
+	gbf_prog_reset(&rsProg, curLen/sizeof(gbf_int_t));
+}
+
+static void defecRsRecv(uint8_t *packet, size_t len, int serial, FecSendDefeccedPacket sendFn) {
+	int bin=serial/rsN;
+	if (len>maxPacketLen) return;
+	if (bin==lastOkBin) return; //already sent this.
+	if (bin!=curBin) {
+		//Did we miss a bin?
+		if (lastOkBin!=bin-1) {
+			if (!defecSkipped((lastOkBin+1)*rsN, bin*rsN)) printf("defecRs: Missed a bin.\n");
+			sendFn(NULL, 0);
+		}
+		newBin(bin, len);
+	}
+	if (curLen!=len) {
+		//shouldn't happen
+		newBin(bin, len);
+	}
+
+	if (!gbf_prog_add(&rsProg, (serial%rsN)+1, (gbf_int_t*)packet)) return;
+	if (rsProg.rank==rsK) {
+		gbf_prog_get(&rsProg, (gbf_int_t*)rsOut);
+		for (int i=0; i<rsK; i++) {
+			sendFn(&rsOut[i*curLen], curLen);
+		}
+		lastOkBin=curBin;
+	}
+}
+
+
+const FecDecoder fecDecoderRs={
+	.algId=FEC_ID_RS,
+	.init=defecRsInit,
+	.recv=defecRsRecv,
+	.deinit=defecRsDeinit
+};
@@ -0,0 +1,173 @@
+/*
+Systematic Reed-Solomon decoding. The first k packets of every bin are plain data, so as long as
+they come in in order they are passed on straight away. Only when one goes missing do we buffer
+what comes after it, and once data plus parity packets add up to k, rebuild what's missing.
+The GF(2^8) Cauchy variant (FEC_ID_CRS) only differs in how the parity is computed, so it
+shares all of this.
+*/
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <arpa/inet.h>
+#include "recvif.h"
+#include "structs.h"
+#include "defec.h"
+#include "redundancy.h"
+#include "crs256.h"
+#include "arena.h"
+
+static uint8_t *sysData;		//k packets
+static uint8_t *sysPar;			//maxPar packets
+static uint8_t **dataPtr, **parPtr;
+static int *parRow;
+static uint8_t *present;
+static int sysK, sysN, maxPar;
+static int maxPacketLen;
+static int curBin;
+static int curLen;
+static int dataCount, parCount;
+static int nextOut;				//next data packet to pass on; k if the bin is done
+static int useCrs;
+static crs_t crs;
+
+static int sysInit(int k, int n, int maxLen) {
+	if (n<=k) return 0;
+	//We never need more parity packets than data packets.
+	maxPar=(n-k<k)?n-k:k;
+	sysData=arenaAlloc(ARENA_FEC, maxLen*k);
+	sysPar=arenaAlloc(ARENA_FEC, maxLen*maxPar);
+	dataPtr=arenaAlloc(ARENA_FEC, sizeof(uint8_t*)*k);
+	parPtr=arenaAlloc(ARENA_FEC, sizeof(uint8_t*)*maxPar);
+	parRow=arenaAlloc(ARENA_FEC, sizeof(int)*maxPar);
+	present=arenaAlloc(ARENA_FEC, k);
+	if (!sysData || !sysPar || !dataPtr || !parPtr || !parRow || !present) return 0;
+	sysK=k;
+	sysN=n;
+	maxPacketLen=maxLen;
+	curBin=-1;
+	return 1;
+}
+
+static int defecRsSysInit(int k, int n, int maxLen) {
+	useCrs=0;
+	gbf_init(GBF_POLYNOME);
+	return sysInit(k, n, maxLen);
+}
+
+static int defecCrsInit(int k, int n, int maxLen) {
+	useCrs=1;
+	if (n<=k || !crs_init(&crs, k, n-k)) return 0;
+	if (!sysInit(k, n, maxLen)) {
+		crs_free(&crs);
+		return 0;
+	}
+	return 1;
+}
+
+//The buffers themselves go back to the arena when defec resets the FEC pool.
+static void defecRsSysDeinit() {
+	sysData=NULL; sysPar=NULL; dataPtr=NULL; parPtr=NULL; parRow=NULL; present=NULL;
+	if (useCrs) crs_free(&crs);
+}
+
+//Pass on data packets in order, for as far as we have them. If giveUp is set, skip over the
+//holes, marking each of them with a NULL packet.
+static void sendData(int giveUp, FecSendDefeccedPacket sendFn) {
+	int inHole=0;
+	while (nextOut<sysK) {
+		if (present[nextOut]) {
+			sendFn(&sysData[nextOut*curLen], curLen);
+			inHole=0;
+		} else if (giveUp) {
+			if (!inHole) sendFn(NULL, 0);
+			inHole=1;
+		} else {
+			return;
+		}
+		nextOut++;
+	}
+}
+
+static void newBin(int bin) {
+	curBin=bin;
+	memset(present, 0, sysK);
+	dataCount=0;
+	parCount=0;
+	nextOut=0;
+	curLen=0;	//taken from the first packet of the bin
+}
+
+static void defecRsSysRecv(uint8_t *packet, size_t len, int serial, FecSendDefeccedPacket sendFn) {
+	int bin=serial/sysN;
+	int idx=serial%sysN;
+	if (len>maxPacketLen) return;
+	if (bin!=curBin) {
+		if (curBin>=0) {
+			//Whatever we couldn't repair in the previous bin is lost.
+			if (nextOut<sysK) printf("defecRsSys: Couldn't repair bin.\n");
+			sendData(1, sendFn);
+			if (bin!=curBin+1) {
+				if (!defecSkipped((curBin+1)*sysN, bin*sysN)) printf("defecRsSys: Missed a bin.\n");
+				sendFn(NULL, 0);
+			}
+		}
+		newBin(bin);
+	}
+	if (nextOut==sysK) return; //bin is done; no need for more
+	if (curLen==0) curLen=len;
+	if (curLen!=len) {
+		//Shouldn't happen. Part of the bin may already have been passed on, so stick with the
+		//length it started with.
+		printf("defecRsSys: dropping packet of %d bytes in a bin of %d byte packets\n", (int)len, curLen);
+		return;
+	}
+
+	//Duplicates (e.g. a packet heard twice) shouldn't count twice towards k.
+	if (idx<sysK) {
+		if (present[idx]) return;
+		memcpy(&sysData[idx*curLen], packet, len);
+		present[idx]=1;
+		dataCount++;
+		sendData(0, sendFn);
+	} else if (parCount<maxPar) {
+		for (int i=0; i<parCount; i++) {
+			if (parRow[i]==idx-sysK) return;
+		}
+		memcpy(&sysPar[parCount*curLen], packet, len);
+		parRow[parCount]=idx-sysK;
+		parCount++;
+	}
+
+	if (nextOut<sysK && dataCount+parCount>=sysK) {
+		//Enough to rebuild the missing data packets.
+		for (int i=0; i<sysK; i++) dataPtr[i]=&sysData[i*curLen];
+		for (int i=0; i<parCount; i++) parPtr[i]=&sysPar[i*curLen];
+		int ok;
+		if (useCrs) {
+			ok=(curLen%CRS_ALIGN==0) && crs_decode(&crs, dataPtr, present, parPtr, parRow, parCount, curLen);
+		} else {
+			ok=gbf_decode_sys((gbf_int_t**)dataPtr, present, (gbf_int_t**)parPtr, parRow, parCount, sysK, curLen/sizeof(gbf_int_t));
+		}
+		if (ok) {
+			memset(present, 1, sysK);
+			sendData(0, sendFn);
+		} else {
+			printf("defecRsSys: decode failed!\n");
+		}
+	}
+}
+
+const FecDecoder fecDecoderRsSys={
+	.algId=FEC_ID_RS_SYS,
+	.init=defecRsSysInit,
+	.recv=defecRsSysRecv,
+	.deinit=defecRsSysDeinit
+};
+
+const FecDecoder fecDecoderCrs={
+	.algId=FEC_ID_CRS,
+	.init=defecCrsInit,
+	.recv=defecRsSysRecv,
+	.deinit=defecRsSysDeinit
+};
@@ -16,6 +16,7 @@ typedef struct HlCallbackInfo HlCallbackInfo;
 struct HlCallbackInfo {
 	int type;
 	HlCallback *cb;
+	HlInterestCallback *icb;
 	void *arg;
 	HlCallbackInfo *next;
 };
@@ -23,15 +24,28 @@ struct HlCallbackInfo {
 static HlCallbackInfo *cbinfo=NULL;
 
 
-void hldemuxAddType(int type, HlCallback cb, void *arg) {
+void hldemuxAddTypeInterest(int type, HlCallback cb, HlInterestCallback icb, void *arg) {
 	HlCallbackInfo *item=malloc(sizeof(HlCallbackInfo));
 	item->type=type;
 	item->cb=cb;
+	item->icb=icb;
 	item->arg=arg;
 	item->next=cbinfo;
 	cbinfo=item;
 }
 
+void hldemuxAddType(int type, HlCallback cb, void *arg) {
+	hldemuxAddTypeInterest(type, cb, NULL, arg);
+}
+
+int hldemuxWants(int type, int secFirst, int secLast) {
+	for (HlCallbackInfo *i=cbinfo; i!=NULL; i=i->next) {
+		if (i->type==type && (i->icb==NULL || i->icb(secFirst, secLast, i->arg))) return 1;
+	}
+	//Nobody handles these (or needs them).
+	return 0;
+}
+
 void hldemuxRecv(uint8_t *packet, size_t len) {
 	if (len<sizeof(HlPacket)) return;
 	HlPacket *p=(HlPacket*)packet;
@@ -5,9 +5,15 @@
 #include "recvif.h"
 
 typedef void (HlCallback)(int subtype, uint8_t *data, int len, void *arg);
+//Return 0 if block changes for sectors secFirst..secLast are of no use.
+typedef int (HlInterestCallback)(int secFirst, int secLast, void *arg);
 
 void hldemuxAddType(int type, HlCallback cb, void *arg);
+//Same, for a handler that can tell whether it needs block changes.
+void hldemuxAddTypeInterest(int type, HlCallback cb, HlInterestCallback icb, void *arg);
 void hldemuxRecv(uint8_t *packet, size_t len);
+//InterestCb: wanted if any handler for the type doesn't say otherwise.
+int hldemuxWants(int type, int secFirst, int secLast);
 
 
 #endif
\ No newline at end of file
@@ -21,6 +21,7 @@
 #include "bd_flatflash.h"
 #include "bd_ropart.h"
 #include "hkpackets.h"
+#include "arena.h"
 
 
 
@@ -96,8 +97,12 @@ int main(int argc, char** argv) {
 	BlockDecodeHandle *ropartblockdecoder;
 
 	chksignInit(defecRecv);
-	defecInit(serdecRecv, 1400);
+	defecInit(serdecRecv, ARENA_MAX_PACKET);
 	serdecInit(hldemuxRecv);
+	//Let stripe descriptors ask the layers above if they need a stripe, before checking it.
+	chksignSetFilter(defecWants);
+	defecSetInterestCb(serdecWants);
+	serdecSetInterestCb(hldemuxWants);
 	
 #if 0 //test flatflash
 
@@ -132,6 +137,7 @@ int main(int argc, char** argv) {
 		if (simDeepSleepMs!=0) break;
 		if ((dly&255)==0) {
 			blockdecodeStatus(ropartblockdecoder);
+			arenaDumpStats();
 		}
 		dly++;
 	}
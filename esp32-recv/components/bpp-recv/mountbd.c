@@ -10,6 +10,7 @@
 #include "mountbd.h"
 #include "diskio.h"
 #include "esp_vfs_fat.h"
+#include "arena.h"
 
 
 #define BD_FAT_SECTOR_SZ 512
@@ -18,6 +19,8 @@ typedef struct {
 	uint8_t drive;
 	BlockdevifHandle *handle;
 	BlockdevIf *iface;
+	uint8_t *blkBuf;	//one block, for reads; FatFs doesn't read a volume from two tasks at once
+	char path[16];		//where it's mounted
 } DriveToBd;
 
 #define NO_BD 4
@@ -40,17 +43,17 @@ static DRESULT bdvfat_read(BYTE pdrv, BYTE *buff, DWORD sector, UINT count) {
 //	printf("bdvfat_read: pdrv %d sect %d len %d\n", (int)pdrv, (int)sector, (int)count);
 	BlockdevifHandle *h=NULL;
 	BlockdevIf *iface=NULL;
+	uint8_t *bbuf=NULL;
 	for (int i=0; i<NO_BD; i++) {
 		if (driveToBd[i].handle!=NULL && driveToBd[i].drive==pdrv) {
 			h=driveToBd[i].handle;
 			iface=driveToBd[i].iface;
+			bbuf=driveToBd[i].blkBuf;
 			break;
 		}
 	}
 	if (!h) return RES_ERROR;
 
-	uint8_t *bbuf=malloc(BLOCKDEV_BLKSZ);
-	if (!bbuf) return RES_ERROR;
 	int bufBlk=-1;
 	int r=1;
 	for (int i=0; i<count; i++) {
@@ -63,7 +66,6 @@ static DRESULT bdvfat_read(BYTE pdrv, BYTE *buff, DWORD sector, UINT count) {
 		}
 		memcpy(&buff[BD_FAT_SECTOR_SZ*i], &bbuf[BD_FAT_SECTOR_SZ*ssect], BD_FAT_SECTOR_SZ);
 	}
-	free(bbuf);
 	return r?RES_OK:RES_ERROR;
 }
 
@@ -93,13 +95,24 @@ static const ff_diskio_impl_t bdRopartVfatDiskioimpl={
 	.ioctl=bdvfat_ioctl,
 };
 
-//ToDo: better error handling (free/unregister stuff)
+//A slot keeps its block buffer for the next mount in it. Once nothing is mounted anymore, the
+//mount pool of the arena starts over.
+static void releaseSlot(int i) {
+	driveToBd[i].handle=NULL;
+	for (int j=0; j<NO_BD; j++) {
+		if (driveToBd[j].handle!=NULL) return;
+	}
+	arenaReset(ARENA_MOUNT);
+	for (int j=0; j<NO_BD; j++) driveToBd[j].blkBuf=NULL;
+}
+
 int bd_mount(BlockdevIf *iface, BlockdevifHandle *h, const char *path, size_t max_files) {
-	FATFS *ret=malloc(sizeof (FATFS));
+	FATFS *fs=NULL; //esp_vfs_fat_register allocates this
 	FRESULT fr;
 	esp_err_t er;
 	BYTE pdrv = 0xFF;
 
+	if (strlen(path)>=sizeof(driveToBd[0].path)) return 0;
 	int i;
 	for (i=0; i<NO_BD; i++) {
 		if (driveToBd[i].handle==NULL) break;
@@ -110,25 +123,46 @@ int bd_mount(BlockdevIf *iface, BlockdevifHandle *h, const char *path, size_t ma
 	if (ff_diskio_get_drive(&pdrv) != ESP_OK) {
 		return 0;
 	}
+	if (driveToBd[i].blkBuf==NULL) driveToBd[i].blkBuf=arenaAlloc(ARENA_MOUNT, BLOCKDEV_BLKSZ);
+	if (driveToBd[i].blkBuf==NULL) return 0;
 	driveToBd[i].drive=pdrv;
 	driveToBd[i].handle=h;
 	driveToBd[i].iface=iface;
+	strcpy(driveToBd[i].path, path);
 
 	//Create logical drive path
 	char drv[3]={'0'+pdrv, ':', 0};
 	printf("bd_mount: using slot %d, pdrv %d (%s)\n", i, (int)pdrv, drv);
-	er=esp_vfs_fat_register(path, drv, max_files, &ret);
+	er=esp_vfs_fat_register(path, drv, max_files, &fs);
 	if (er!=ESP_OK) {
 		printf("bd_mount: esp_vfs_fat_register failed: %x\n", er);
+		releaseSlot(i);
 		return 0;
 	}
 	ff_diskio_register(pdrv, &bdRopartVfatDiskioimpl);
-	fr=f_mount(ret, drv, 1);
+	fr=f_mount(fs, drv, 1);
 	if (fr!=FR_OK) {
 		printf("bd_mount: f_mount failed: %x\n", fr);
+		ff_diskio_register(pdrv, NULL);
+		esp_vfs_fat_unregister_path(path);
+		releaseSlot(i);
 		return 0;
 	}
 	
 	return 1;
 }
 
+int bd_unmount(const char *path) {
+	int i;
+	for (i=0; i<NO_BD; i++) {
+		if (driveToBd[i].handle!=NULL && strcmp(driveToBd[i].path, path)==0) break;
+	}
+	if (i==NO_BD) return 0;
+	char drv[3]={'0'+driveToBd[i].drive, ':', 0};
+	f_mount(NULL, drv, 0);
+	ff_diskio_register(driveToBd[i].drive, NULL);
+	esp_vfs_fat_unregister_path(path);
+	releaseSlot(i);
+	return 1;
+}
+
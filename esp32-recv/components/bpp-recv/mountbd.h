@@ -2,6 +2,8 @@
 #define MOUNTBD_H
 
 int bd_mount(BlockdevIf *iface, BlockdevifHandle *h, const char *path, size_t max_files);
+//Undo bd_mount for the block device mounted at path. Returns 0 if nothing is mounted there.
+int bd_unmount(const char *path);
 
 
 #endif
\ No newline at end of file
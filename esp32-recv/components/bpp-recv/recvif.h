@@ -2,5 +2,8 @@
 #define SENDIF_H
 
 typedef void (RecvCb)(uint8_t *packet, size_t len);
+//Does anything above want HL packets of this type for sectors secFirst..secLast? Used to skip
+//stripes (see StripeDesc) before doing any work on them.
+typedef int (InterestCb)(int type, int secFirst, int secLast);
 
 #endif
\ No newline at end of file
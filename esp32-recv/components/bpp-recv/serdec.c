@@ -8,64 +8,151 @@ Decode the flexible length packets encoded in the fixed-length stream
 #include <arpa/inet.h>
 #include "recvif.h"
 #include "structs.h"
-#ifndef HOST_BUILD
-#include "rom/crc.h"
-#endif
 #include "crc16-ccitt.h"
 #include "hexdump.h"
 
 #define MAX_PACKET_LEN (8*1024)
 
 static RecvCb *recvCb;
+static InterestCb *interestCb;
 
 static uint8_t serPacket[MAX_PACKET_LEN];
 static SerdesHdr hdr;
-static int pos=-1;
+static int hdrHave=0; //bytes of hdr we have; sizeof(SerdesHdr) means we're receiving the packet
+static int pos=0;
+static uint16_t crc; //over what we have of the packet so far, header included
 static int hdrBytesScanned=0; //for information purposes
 
+//When a header turns out to be bogus, the bytes following its magic may still contain the real
+//one. They get fed through the decoder again from here, before any new input.
+static uint8_t replayBuf[sizeof(SerdesHdr)-1+MAX_PACKET_LEN];
+static int replayLen=0;
+static int resync=0; //set when the header we were working on turned out to be bogus
+
+static const uint8_t magic[4]={SERDES_MAGIC>>24, (SERDES_MAGIC>>16)&0xff, (SERDES_MAGIC>>8)&0xff, SERDES_MAGIC&0xff};
+
 
 void serdecInit(RecvCb *cb) {
 	recvCb=cb;
 }
 
-static int scanHdr(uint8_t in) {
+void serdecSetInterestCb(InterestCb *cb) {
+	interestCb=cb;
+}
+
+//A packet that runs on into a stripe is included in that stripe's descriptor, so whether we're
+//halfway one doesn't matter here; just ask upstairs.
+int serdecWants(int type, int secFirst, int secLast) {
+	return interestCb?interestCb(type, secFirst, secLast):1;
+}
+
+//Find (the rest of) a header in data. Returns the amount of bytes used.
+static int scanHdr(const uint8_t *data, int len) {
 	uint8_t *h=(uint8_t*)&hdr;
-	//Scanning for header
-	hdrBytesScanned++;
-	for (int x=1; x<sizeof(SerdesHdr); x++) h[x-1]=h[x];
-	h[sizeof(SerdesHdr)-1]=in;
-	if (ntohl(hdr.magic)==SERDES_MAGIC) {
+	int i=0;
+	if (hdrHave==0) {
+		//memchr goes through the data a word at a time, which matters as it usually has to
+		//skip a whole packet or a block of zero padding.
+		const uint8_t *m=memchr(data, magic[0], len);
+		if (m==NULL) {
+			hdrBytesScanned+=len;
+			return len;
+		}
+		i=m-data;
+		hdrBytesScanned+=i;
+		h[hdrHave++]=data[i++];
+	}
+	while (hdrHave<sizeof(magic) && i<len) {
+		if (data[i]!=magic[hdrHave]) {
+			//No match. The first magic byte appears only once in the magic, so the only place
+			//a new one can start is at this byte; leave it for the memchr.
+			hdrBytesScanned+=hdrHave;
+			hdrHave=0;
+			return i;
+		}
+		h[hdrHave++]=data[i++];
+	}
+	while (hdrHave<sizeof(SerdesHdr) && i<len) h[hdrHave++]=data[i++];
+	if (hdrHave==sizeof(SerdesHdr)) {
 		if (ntohs(hdr.len)<MAX_PACKET_LEN) {
-//			if (hdrBytesScanned!=sizeof(SerdesHdr)) {
-//				printf("Serdec: skipped %d bytes\n", hdrBytesScanned-sizeof(SerdesHdr));
+//			if (hdrBytesScanned!=0) {
+//				printf("Serdec: skipped %d bytes\n", hdrBytesScanned);
 //			}
 			hdrBytesScanned=0;
-			return 1;
+			pos=0;
+			//The CRC is taken over the header with the crc16 field zeroed.
+			uint16_t rcrc=hdr.crc16;
+			hdr.crc16=0;
+			crc=crc16_ccitt(0, (uint8_t*)&hdr, sizeof(SerdesHdr));
+			hdr.crc16=rcrc;
+		} else {
+			resync=1;
 		}
 	}
-	return 0;
+	return i;
 }
 
-
 static void finishPacket() {
 	int plen=ntohs(hdr.len);
-#ifndef HOST_BUILD
-	uint16_t crc, rcrc;
-	rcrc=ntohs(hdr.crc16);
-	hdr.crc16=0;
-//	crc=crc16_le(0, (uint8_t*)&hdr, sizeof(SerdesHdr));
-//	crc=crc16_le(crc, serPacket, plen);
-	crc=crc16_ccitt(0, (uint8_t*)&hdr, sizeof(SerdesHdr));
-	crc=crc16_ccitt(crc, serPacket, plen);
+	uint16_t rcrc=ntohs(hdr.crc16);
 	if (crc!=rcrc) {
 		printf("Serdec: CRC16 error! Got %04X expected %04X\n", crc, rcrc);
 		//hexdump(serPacket, plen);
+		resync=1;
 	} else {
 		recvCb(serPacket, plen);
+		hdrHave=0;
+	}
+}
+
+//Run data through the decoder. Returns the amount of bytes used; this stops short when a
+//header turns out to be bogus, with resync set.
+static int consume(const uint8_t *data, int len) {
+	int i=0;
+	while (i<len && !resync) {
+		if (hdrHave<sizeof(SerdesHdr)) {
+			i+=scanHdr(&data[i], len-i);
+			if (hdrHave<sizeof(SerdesHdr)) continue;
+		} else {
+			//Receiving
+			int plen=ntohs(hdr.len);
+			int left=plen-pos;
+			if (left>(len-i)) left=len-i;
+			crc=crc16_ccitt_copy(crc, &serPacket[pos], &data[i], left);
+			pos+=left;
+			i+=left;
+		}
+		if (!resync && pos==ntohs(hdr.len)) finishPacket();
 	}
-#else
-	recvCb(serPacket, plen);
-#endif
+	return i;
+}
+
+//Queue everything after the magic of the bogus header, followed by <restLen> bytes of
+//not-yet-used replay data at <rest>, for another look.
+static void queueReplay(const uint8_t *rest, int restLen) {
+	int plen=(ntohs(hdr.len)<MAX_PACKET_LEN)?pos:0;
+	int n=sizeof(SerdesHdr)-1;
+	//The bogus packet was made out of the data in front of rest, so this only moves it back.
+	//Nothing to move when called from the end of a packet; rest is NULL then.
+	if (restLen>0) memmove(&replayBuf[n+plen], rest, restLen);
+	memcpy(replayBuf, ((uint8_t*)&hdr)+1, n);
+	memcpy(&replayBuf[n], serPacket, plen);
+	replayLen=n+plen+restLen;
+	hdrBytesScanned+=1;
+	hdrHave=0;
+	resync=0;
+}
+
+static void replay() {
+	int done=0;
+	while (done<replayLen) {
+		done+=consume(&replayBuf[done], replayLen-done);
+		if (resync) {
+			queueReplay(&replayBuf[done], replayLen-done);
+			done=0;
+		}
+	}
+	replayLen=0;
 }
 
 void serdecRecv(uint8_t *packet, size_t len) {
@@ -74,31 +161,15 @@ void serdecRecv(uint8_t *packet, size_t len) {
 		//Used to indicate some packets got lost. Reset receive system, discard
 		//any data we may have received, propagate lost packet info up.
 		recvCb(NULL, 0);
-		pos=-1;
-		memset(&hdr, 0, sizeof(SerdesHdr));
+		hdrHave=0;
 		return;
 	}
 
 	while (i<len) {
-		if (pos==-1) {
-			if (scanHdr(packet[i])) {
-				pos=0;
-			}
-			i++;
-		} else {
-			//Receiving
-			int plen=ntohs(hdr.len);
-			int left=plen-pos;
-			if (left>(len-i)) left=len-i;
-			memcpy(&serPacket[pos], &packet[i], left);
-			//printf("Pos=%d plen=%d len=%d  i=%d (len-i)=%d left=%d\n", pos, plen, len, i, len-i, left);
-			pos+=left;
-			i+=left;
-			if (pos==plen) {
-				finishPacket();
-				pos=-1;
-				memset(&hdr, 0, sizeof(SerdesHdr));
-			}
+		i+=consume(&packet[i], len-i);
+		if (resync) {
+			queueReplay(NULL, 0);
+			replay();
 		}
 	}
 }
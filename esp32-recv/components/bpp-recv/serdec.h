@@ -5,5 +5,8 @@
 
 void serdecInit(RecvCb *cb);
 void serdecRecv(uint8_t *packet, size_t len);
+void serdecSetInterestCb(InterestCb *cb);
+//InterestCb for the layer below.
+int serdecWants(int type, int secFirst, int secLast);
 
 #endif
\ No newline at end of file
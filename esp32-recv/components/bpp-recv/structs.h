@@ -22,15 +22,41 @@ typedef struct {
 
 
 //A serial of 0 means something special: it defines the FEC parameters in use.
+//With an interleave depth D>1, the serials are grouped in blocks of D*n. Packet i of stripe s
+//in a block goes out as serial blockstart+i*D+s, so a burst of lost packets is spread over D
+//stripes. Older servers don't send the interleave byte; treat that (and 0) as 1.
 typedef struct {
 	uint16_t k;
 	uint16_t n;
 	uint8_t fecAlgoId;
+	uint8_t interleave;
 } __attribute__ ((packed)) FecDesc;
 
 
 #define FEC_ID_PARITY 0 //Simple parity addition
 #define FEC_ID_RS 1     //Reed-Solomon with tsd's code
+#define FEC_ID_RS_SYS 2 //Systematic Reed-Solomon: k plain data packets, then n-k parity packets
+#define FEC_ID_CRS 3    //Same, with GF(2^8) Cauchy bit-matrix parity. Packet length is a multiple of 32.
+#define FEC_ID_LT 4     //Systematic LT fountain code: k data packets, then n-k XOR repair packets
+
+
+/*
+Stripe content descriptor. The server can send one of these, signed on its own, in a FecPacket
+with serial FEC_SERIAL_STRIPEDESC ahead of every stripe (with interleaving: every block). It
+says what the HL packets that have bytes in those serials are, so a receiver that needs none of
+it can drop the packets before checking their signatures or decoding them. Older receivers take
+the serial for a duplicate and ignore it.
+*/
+#define FEC_SERIAL_STRIPEDESC 0xFFFFFFFF
+#define STRIPEDESC_TYPE_ANY 0xFFFF //mixed or other content; everyone should take the stripe
+
+typedef struct {
+	uint32_t firstSerial;
+	uint16_t count;		//serials described, starting at firstSerial
+	uint16_t type;		//HL type of all packets in the stripe, or STRIPEDESC_TYPE_ANY
+	uint16_t secFirst;	//...which are all BDSYNC_SUBTYPE_CHANGE packets for sectors
+	uint16_t secLast;	//secFirst to secLast
+} __attribute__ ((packed)) StripeDesc;
 
 
 //Randomly chosen
@@ -44,9 +70,28 @@ typedef struct {
 
 
 /*
-Hashing: Hmm. Every now and then (8 packets?) een ECC-encrypted pakket met de hashes van
-de voorgaande X pakketten?
+Hash-chained authentication. Instead of a signature, the server can prefix a packet with
+HASHED_MAGIC; every now and then it then sends a normal SignedPacket whose data is a
+HashListPacket with the hashes of the hashed packets sent since the previous list. Receivers
+hold hashed packets until a list vouches for them. The hash is the first HASHLIST_HASH_LEN
+bytes of the SHA-512 of the packet after the magic.
 */
+#define HASHED_MAGIC 0x5A17C4A1
+
+typedef struct {
+	uint32_t magic; //must be HASHED_MAGIC
+	uint8_t data[];
+} __attribute__ ((packed)) HashedPacket;
+
+#define HASHLIST_MAGIC 0x5A17C4A2
+#define HASHLIST_HASH_LEN 16
+#define HASHLIST_MAX_HASHES 16 //receivers only buffer a little more than this
+
+typedef struct {
+	uint32_t magic; //must be HASHLIST_MAGIC
+	uint8_t count;
+	uint8_t hash[][HASHLIST_HASH_LEN];
+} __attribute__ ((packed)) HashListPacket;
 
 #define BLOCKDEV_BLKSZ 4096
 
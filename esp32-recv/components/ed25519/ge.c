@@ -57,6 +57,102 @@ static void slide(signed char *r, const unsigned char *a) {
         }
 }
 
+/*
+Like slide(), but for nbits bits and digits up to +-(2^(w-1)-1).
+*/
+
+static void slide_w(signed char *r, const unsigned char *a, int nbits, int w) {
+    int i;
+    int b;
+    int k;
+    int bound = (1 << (w - 1)) - 1;
+
+    for (i = 0; i < nbits; ++i) {
+        r[i] = 1 & (a[i >> 3] >> (i & 7));
+    }
+
+    for (i = 0; i < nbits; ++i)
+        if (r[i]) {
+            for (b = 1; b <= w + 1 && i + b < nbits; ++b) {
+                if (r[i + b]) {
+                    if (r[i] + (r[i + b] << b) <= bound) {
+                        r[i] += r[i + b] << b;
+                        r[i + b] = 0;
+                    } else if (r[i] - (r[i + b] << b) >= -bound) {
+                        r[i] -= r[i + b] << b;
+
+                        for (k = i + b; k < nbits; ++k) {
+                            if (!r[k]) {
+                                r[k] = 1;
+                                break;
+                            }
+
+                            r[k] = 0;
+                        }
+                    } else {
+                        break;
+                    }
+                }
+            }
+        }
+}
+
+/*
+r = a * A + b * B, with A fixed and its multiples precomputed.
+
+Both scalars are split in 128-bit halves, a = a0 + 2^128 a1, so this only needs half the
+doublings of ge_double_scalarmult_vartime: every entry of T holds the odd multiple
+(2i+1) of A, 2^128 A, B and 2^128 B, in that order. T has 2^(w-2) entries.
+a and b must be below 2^253.
+*/
+
+void ge_double_scalarmult_precomp_vartime(ge_p2 *r, const unsigned char *a, const unsigned char *b, const ge_precomp (*T)[4], int w) {
+    signed char slides[4][129];
+    unsigned char half[17];
+    const unsigned char *parts[4];
+    ge_p1p1 t;
+    ge_p3 u;
+    int i;
+    int j;
+    parts[0] = a;
+    parts[1] = a + 16;
+    parts[2] = b;
+    parts[3] = b + 16;
+
+    /* the extra zero byte catches the carry out of the top digit */
+    half[16] = 0;
+    for (j = 0; j < 4; ++j) {
+        for (i = 0; i < 16; ++i) {
+            half[i] = parts[j][i];
+        }
+        slide_w(slides[j], half, 129, w);
+    }
+
+    ge_p2_0(r);
+
+    for (i = 128; i >= 0; --i) {
+        if (slides[0][i] || slides[1][i] || slides[2][i] || slides[3][i]) {
+            break;
+        }
+    }
+
+    for (; i >= 0; --i) {
+        ge_p2_dbl(&t, r);
+
+        for (j = 0; j < 4; ++j) {
+            if (slides[j][i] > 0) {
+                ge_p1p1_to_p3(&u, &t);
+                ge_madd(&t, &u, &T[slides[j][i] / 2][j]);
+            } else if (slides[j][i] < 0) {
+                ge_p1p1_to_p3(&u, &t);
+                ge_msub(&t, &u, &T[(-slides[j][i]) / 2][j]);
+            }
+        }
+
+        ge_p1p1_to_p2(r, &t);
+    }
+}
+
 /*
 r = a * A + b * B
 where a = a[0]+256*a[1]+...+256^31 a[31].
@@ -299,6 +395,23 @@ static const fe d2 = {
     -21827239, -5839606, -30745221, 13898782, 229458, 15978800, -12551817, -6495438, 29715968, 9444199
 };
 
+/*
+r = p, in affine (Duif) form
+*/
+
+void ge_p3_to_precomp(ge_precomp *r, const ge_p3 *p) {
+    fe recip;
+    fe x;
+    fe y;
+    fe_invert(recip, p->Z);
+    fe_mul(x, p->X, recip);
+    fe_mul(y, p->Y, recip);
+    fe_add(r->yplusx, y, x);
+    fe_sub(r->yminusx, y, x);
+    fe_mul(r->xy2d, x, y);
+    fe_mul(r->xy2d, r->xy2d, d2);
+}
+
 void ge_p3_to_cached(ge_cached *r, const ge_p3 *p) {
     fe_add(r->YplusX, p->Y, p->X);
     fe_sub(r->YminusX, p->Y, p->X);
@@ -27,6 +27,13 @@ int ED25519_DECLSPEC ed25519_create_seed(unsigned char *seed);
 void ED25519_DECLSPEC ed25519_create_keypair(unsigned char *public_key, unsigned char *private_key, const unsigned char *seed);
 void ED25519_DECLSPEC ed25519_sign(unsigned char *signature, const unsigned char *message, size_t message_len, const unsigned char *public_key, const unsigned char *private_key);
 int ED25519_DECLSPEC ed25519_verify(const unsigned char *signature, const unsigned char *message, size_t message_len, const unsigned char *public_key);
+
+/* verifying against a fixed key: precompute a table of ED25519_PRECOMP_SIZE(window) bytes once */
+#define ED25519_PRECOMP_MIN_WINDOW 5
+#define ED25519_PRECOMP_MAX_WINDOW 8
+#define ED25519_PRECOMP_SIZE(window) ((1 << ((window) - 2)) * 4 * 30 * 4)
+int ED25519_DECLSPEC ed25519_precompute_key(void *table, const unsigned char *public_key, int window);
+int ED25519_DECLSPEC ed25519_verify_precomp(const unsigned char *signature, const unsigned char *message, size_t message_len, const unsigned char *public_key, const void *table, int window);
 void ED25519_DECLSPEC ed25519_add_scalar(unsigned char *public_key, unsigned char *private_key, const unsigned char *scalar);
 void ED25519_DECLSPEC ed25519_key_exchange(unsigned char *shared_secret, const unsigned char *public_key, const unsigned char *private_key);
 
@@ -0,0 +1,90 @@
+#include "ed25519.h"
+#include "sha512.h"
+#include "ge.h"
+#include "sc.h"
+
+/*
+Verification against a fixed public key. The odd multiples of the key (and of the base point)
+that ed25519_verify works out for every signature are computed once, up front; see
+ge_double_scalarmult_precomp_vartime for the table layout.
+*/
+
+static void dbl128(ge_p3 *r, const ge_p3 *p) {
+    ge_p1p1 t;
+    int i;
+    *r = *p;
+    for (i = 0; i < 128; ++i) {
+        ge_p3_dbl(&t, r);
+        ge_p1p1_to_p3(r, &t);
+    }
+}
+
+int ed25519_precompute_key(void *table, const unsigned char *public_key, int window) {
+    ge_precomp (*T)[4] = (ge_precomp (*)[4]) table;
+    unsigned char one[32] = {1};
+    ge_p3 P[4];
+    ge_p3 P2;
+    ge_p3 u;
+    ge_p1p1 t;
+    ge_cached c;
+    int entries;
+    int i;
+    int j;
+
+    if (window < ED25519_PRECOMP_MIN_WINDOW || window > ED25519_PRECOMP_MAX_WINDOW) {
+        return 0;
+    }
+
+    /* verification needs -A */
+    if (ge_frombytes_negate_vartime(&P[0], public_key) != 0) {
+        return 0;
+    }
+
+    dbl128(&P[1], &P[0]);
+    ge_scalarmult_base(&P[2], one);
+    dbl128(&P[3], &P[2]);
+
+    entries = 1 << (window - 2);
+    for (j = 0; j < 4; ++j) {
+        ge_p3_dbl(&t, &P[j]);
+        ge_p1p1_to_p3(&P2, &t);
+        ge_p3_to_cached(&c, &P2);
+        u = P[j];
+        for (i = 0; i < entries; ++i) {
+            ge_p3_to_precomp(&T[i][j], &u);
+            ge_add(&t, &u, &c);
+            ge_p1p1_to_p3(&u, &t);
+        }
+    }
+
+    return 1;
+}
+
+int ed25519_verify_precomp(const unsigned char *signature, const unsigned char *message, size_t message_len, const unsigned char *public_key, const void *table, int window) {
+    unsigned char h[64];
+    unsigned char checker[32];
+    unsigned char r = 0;
+    sha512_context hash;
+    ge_p2 R;
+    int i;
+
+    if (signature[63] & 224) {
+        return 0;
+    }
+
+    sha512_init(&hash);
+    sha512_update(&hash, signature, 32);
+    sha512_update(&hash, public_key, 32);
+    sha512_update(&hash, message, message_len);
+    sha512_final(&hash, h);
+
+    sc_reduce(h);
+    ge_double_scalarmult_precomp_vartime(&R, h, signature + 32, (const ge_precomp (*)[4]) table, window);
+    ge_tobytes(checker, &R);
+
+    for (i = 0; i < 32; ++i) {
+        r |= checker[i] ^ signature[i];
+    }
+
+    return !r;
+}
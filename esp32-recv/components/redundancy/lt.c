@@ -0,0 +1,273 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "lt.h"
+#include "redundancy.h"
+
+// Everything here is integer math, so sender and receiver agree on every
+// distribution and every pick, whatever their floating point does.
+
+#define LT_SCALE (1 << 24)
+
+static int
+lt_isqrt(int v)
+{
+	int r = 0;
+	while ((r + 1) * (r + 1) <= v)
+		r++;
+	return r;
+}
+
+static int
+lt_ilog2(int v)
+{
+	int r = 0;
+	while (v >>= 1)
+		r++;
+	return r;
+}
+
+static uint32_t
+lt_rand(uint32_t *s)
+{
+	uint32_t x = *s;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	return *s = x;
+}
+
+int
+lt_init(lt_t *c, int k)
+{
+	if (k < 1 || k > LT_MAX_K)
+		return 0;
+	c->k = k;
+	c->max_deg = k;
+	c->cdf = malloc(sizeof(uint32_t) * (k + 1));
+	if (c->cdf == NULL)
+		return 0;
+
+	/* Robust soliton: the ideal soliton rho plus a spike tau at k/R, with
+	 * R = sqrt(k) and delta = 0.05. ln(R/delta) is done in hundredths.
+	 */
+	int r = lt_isqrt(k);
+	int spike = k / r;
+	int ln_r_delta = lt_ilog2(r) * 69 + 300;
+	uint32_t sum = 0;
+	c->cdf[0] = 0;
+	for (int d=1; d<=k; d++)
+	{
+		uint32_t w = (d == 1) ? LT_SCALE / k : LT_SCALE / (d * (d - 1));
+		if (d < spike)
+			w += (uint64_t)LT_SCALE * r / (d * k);
+		else if (d == spike)
+			w += (uint64_t)LT_SCALE * r * ln_r_delta / (100 * k);
+		sum += w;
+		c->cdf[d] = sum;
+	}
+	/* With blocks this small, low degree repair symbols too often only tell
+	 * us what we already know. Raising the floor to about log2(k) costs a few
+	 * XORs and brings the overhead down to a few symbols.
+	 */
+	c->min_deg = lt_ilog2(k) + 1;
+	if (c->min_deg > k / 2)
+		c->min_deg = (k > 1) ? k / 2 : 1;
+	return 1;
+}
+
+void
+lt_free(lt_t *c)
+{
+	free(c->cdf);
+	c->cdf = NULL;
+}
+
+int
+lt_symbol(const lt_t *c, uint32_t esi, uint16_t *idx)
+{
+	int k = c->k;
+	if (esi < (uint32_t)k)
+	{
+		idx[0] = esi;
+		return 1;
+	}
+	uint32_t s = (esi + 1) * 0x9e3779b9u ^ ((uint32_t)k << 16);
+	if (s == 0)
+		s = 1;
+	lt_rand(&s);
+	uint32_t pick = ((uint64_t)lt_rand(&s) * c->cdf[c->max_deg]) >> 32;
+	int deg = 1;
+	while (c->cdf[deg] <= pick)
+		deg++;
+	if (deg < c->min_deg)
+		deg = c->min_deg;
+
+	uint32_t used[(LT_MAX_K + 31) / 32] = {0};
+	int n = 0;
+	while (n < deg)
+	{
+		int i = lt_rand(&s) % k;
+		if (used[i / 32] & (1u << (i % 32)))
+			continue;
+		used[i / 32] |= 1u << (i % 32);
+		idx[n++] = i;
+	}
+	return deg;
+}
+
+void
+lt_encode(const lt_t *c, uint32_t esi, uint8_t **src, uint8_t *out, int len)
+{
+	uint16_t idx[LT_MAX_K];
+	int deg = lt_symbol(c, esi, idx);
+	memcpy(out, src[idx[0]], len);
+	for (int i=1; i<deg; i++)
+		gbf_xor_region(out, src[idx[i]], len);
+}
+
+#define LT_ALIGN8(x) (((x) + 7) & ~(size_t)7)
+
+size_t
+lt_dec_mem(int k, int max_len)
+{
+	int words = (k + 31) / 32;
+	return LT_ALIGN8((size_t)k * max_len) + LT_ALIGN8(sizeof(uint32_t) * (k + 1) * words)
+		+ LT_ALIGN8(sizeof(int) * k) * 2 + LT_ALIGN8(sizeof(uint16_t) * k) + LT_ALIGN8(k);
+}
+
+int
+lt_dec_init(lt_dec_t *d, const lt_t *c, int max_len, void *mem)
+{
+	int k = c->k;
+	memset(d, 0, sizeof(*d));
+	if (mem == NULL)
+	{
+		mem = malloc(lt_dec_mem(k, max_len));
+		if (mem == NULL)
+			return 0;
+		d->own_mem = mem;
+	}
+	uint8_t *m = mem;
+	d->code = c;
+	d->max_len = max_len;
+	d->words = (k + 31) / 32;
+	d->sym = m;
+	m += LT_ALIGN8((size_t)k * max_len);
+	d->coef = (uint32_t *)m;
+	d->scratch = &d->coef[k * d->words];
+	m += LT_ALIGN8(sizeof(uint32_t) * (k + 1) * d->words);
+	d->order = (int *)m;
+	m += LT_ALIGN8(sizeof(int) * k);
+	d->xors = (int *)m;
+	m += LT_ALIGN8(sizeof(int) * k);
+	d->idx = (uint16_t *)m;
+	m += LT_ALIGN8(sizeof(uint16_t) * k);
+	d->solved = m;
+	lt_dec_reset(d, max_len);
+	return 1;
+}
+
+void
+lt_dec_free(lt_dec_t *d)
+{
+	free(d->own_mem);
+	memset(d, 0, sizeof(*d));
+}
+
+void
+lt_dec_reset(lt_dec_t *d, int len)
+{
+	d->len = (len < d->max_len) ? len : d->max_len;
+	d->rank = 0;
+	d->solved_all = 0;
+	memset(d->solved, 0, d->code->k);
+}
+
+/* The stored rows are kept so that a row never has a bit set at the pivot of
+ * a row that was stored before it. Reducing a new symbol against the rows in
+ * the order they were stored then clears every pivot bit in one pass, and
+ * back-substitution in the opposite order solves everything.
+ */
+int
+lt_dec_add(lt_dec_t *d, uint32_t esi, const uint8_t *data)
+{
+	int k = d->code->k;
+	int words = d->words;
+	uint32_t *row = d->scratch;
+	if (d->rank == k)
+		return 0;
+
+	memset(row, 0, sizeof(uint32_t) * words);
+	int deg = lt_symbol(d->code, esi, d->idx);
+	for (int i=0; i<deg; i++)
+		row[d->idx[i] / 32] |= 1u << (d->idx[i] % 32);
+
+	int num_xors = 0;
+	for (int i=0; i<d->rank; i++)
+	{
+		int p = d->order[i];
+		if (!(row[p / 32] & (1u << (p % 32))))
+			continue;
+		uint32_t *prow = &d->coef[p * words];
+		for (int w=0; w<words; w++)
+			row[w] ^= prow[w];
+		d->xors[num_xors++] = p;
+	}
+
+	int pivot = -1, weight = 0;
+	for (int w=0; w<words; w++)
+	{
+		if (row[w] == 0)
+			continue;
+		if (pivot < 0)
+			pivot = w * 32 + __builtin_ctz(row[w]);
+		weight += __builtin_popcount(row[w]);
+	}
+	if (pivot < 0)
+		return 0;
+
+	// Only now that we know where it goes does the data get touched.
+	uint8_t *dst = &d->sym[pivot * d->max_len];
+	memcpy(dst, data, d->len);
+	for (int i=0; i<num_xors; i++)
+		gbf_xor_region(dst, &d->sym[d->xors[i] * d->max_len], d->len);
+	memcpy(&d->coef[pivot * words], row, sizeof(uint32_t) * words);
+	d->solved[pivot] = (weight == 1);
+	d->order[d->rank++] = pivot;
+	return 1;
+}
+
+static void
+lt_dec_solve(lt_dec_t *d)
+{
+	int words = d->words;
+	for (int i=d->rank-1; i>=0; i--)
+	{
+		int p = d->order[i];
+		uint32_t *row = &d->coef[p * words];
+		for (int w=0; w<words; w++)
+		{
+			uint32_t bits = row[w];
+			while (bits)
+			{
+				int c = w * 32 + __builtin_ctz(bits);
+				bits &= bits - 1;
+				if (c != p)
+					gbf_xor_region(&d->sym[p * d->max_len], &d->sym[c * d->max_len], d->len);
+			}
+			row[w] = 0;
+		}
+		row[p / 32] = 1u << (p % 32);
+		d->solved[p] = 1;
+	}
+	d->solved_all = 1;
+}
+
+const uint8_t *
+lt_dec_get(lt_dec_t *d, int i)
+{
+	if (d->rank == d->code->k && !d->solved_all)
+		lt_dec_solve(d);
+	return d->solved[i] ? &d->sym[i * d->max_len] : NULL;
+}
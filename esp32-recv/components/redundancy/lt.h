@@ -0,0 +1,93 @@
+#ifndef LT_H
+#define LT_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* LT (fountain) code over GF(2).
+ *
+ *   A source block of k symbols can be expanded into as many encoded symbols
+ *   as wanted. Symbol <esi> 0..k-1 is source symbol esi itself; every symbol
+ *   after that is the XOR of a few source symbols, picked by a pseudo-random
+ *   generator seeded with esi, with the number of them drawn from a robust
+ *   soliton distribution. Both sides derive the same picks from (k, esi), so
+ *   nothing but the esi has to be sent along.
+ *
+ *   Any set of symbols that spans all k source symbols decodes; in practice
+ *   that takes a few more than k of them. The decoder does incremental
+ *   Gaussian elimination, so unlike plain peeling it never needs more symbols
+ *   than the set mathematically requires.
+ */
+
+#define LT_MAX_K 256
+
+typedef struct {
+	int k;
+	int min_deg, max_deg;
+	uint32_t *cdf;       // [max_deg+1] cumulative degree weights
+} lt_t;
+
+/* lt_init(c, k)
+ *   Set up a code for source blocks of k symbols. Returns 0 if k is out of
+ *   range or memory runs out.
+ */
+extern int lt_init(lt_t *c, int k);
+extern void lt_free(lt_t *c);
+
+/* lt_symbol(c, esi, idx[k])
+ *   Which source symbols encoded symbol <esi> is the XOR of. Fills idx and
+ *   returns how many there are.
+ */
+extern int lt_symbol(const lt_t *c, uint32_t esi, uint16_t *idx);
+
+/* lt_encode(c, esi, src[k][len], out[len], len)
+ */
+extern void lt_encode(const lt_t *c, uint32_t esi, uint8_t **src, uint8_t *out, int len);
+
+typedef struct {
+	const lt_t *code;
+	int max_len, len;
+	int words;           // uint32_t per coefficient row
+	int rank;
+	int solved_all;      // back-substitution done
+	uint8_t *sym;        // [k][max_len], row with pivot column i at i
+	uint32_t *coef;      // [k][words]
+	uint32_t *scratch;   // [words]
+	int *order;          // pivot columns, in the order they were found
+	uint8_t *solved;     // [k] that row is the plain source symbol
+	uint16_t *idx;       // [k] for lt_symbol
+	int *xors;           // [k] rows to XOR into an incoming symbol
+	void *own_mem;       // what lt_dec_init allocated itself
+} lt_dec_t;
+
+/* lt_dec_mem(k, max_len)
+ *   How many bytes of memory a decoder needs.
+ */
+extern size_t lt_dec_mem(int k, int max_len);
+
+/* lt_dec_init(d, c, max_len, mem)
+ *   Set up a decoder for code c and symbols of up to max_len bytes, in <mem>:
+ *   lt_dec_mem() bytes, 8-byte aligned. With mem NULL, it gets allocated.
+ *   Returns 0 if memory runs out.
+ */
+extern int lt_dec_init(lt_dec_t *d, const lt_t *c, int max_len, void *mem);
+extern void lt_dec_free(lt_dec_t *d);
+
+/* lt_dec_reset(d, len)
+ *   Forget everything and start on a new source block of <len> byte symbols.
+ */
+extern void lt_dec_reset(lt_dec_t *d, int len);
+
+/* lt_dec_add(d, esi, data[len])
+ *   Feed the decoder a symbol. Returns 1 if it told the decoder something new,
+ *   0 if it was redundant.
+ */
+extern int lt_dec_add(lt_dec_t *d, uint32_t esi, const uint8_t *data);
+
+/* lt_dec_get(d, i)
+ *   Source symbol i, or NULL if it isn't known yet. Once the decoder has k
+ *   independent symbols, all of them are.
+ */
+extern const uint8_t *lt_dec_get(lt_dec_t *d, int i);
+
+#endif // LT_H
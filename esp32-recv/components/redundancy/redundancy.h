@@ -23,6 +23,16 @@
  #define GBF_POLYNOME 0x1b
 #endif
 
+/* Multiplication backends; pick one by defining GBF_MUL_BACKEND when building redundancy.c.
+ *   GBF_MUL_CLMUL:  4-bit carry-less multiply lookups. Smallest tables, slowest.
+ *   GBF_MUL_LOGEXP: log/antilog tables; 384K of RAM, so meant for the host.
+ *   GBF_MUL_SPLIT:  (default) two 256-entry tables of multiples of a coefficient,
+ *                   built once for every run of words it multiplies. 1K of stack.
+ */
+#define GBF_MUL_CLMUL 0
+#define GBF_MUL_LOGEXP 1
+#define GBF_MUL_SPLIT 2
+
 /* gbf_init(polynome);
  *   Library needs to be initialized with a specific polynome.
  *
@@ -58,6 +68,26 @@ extern gbf_int_t gbf_inv_phi(gbf_int_t v1); // slower, alternative method
  */
 extern void gbf_invmatrix(gbf_int_t *matrix, int size);
 
+/* gbf_invmatrix_pivot(matrix[size*size], size)
+ *   Same, for any matrix: gbf_invmatrix() relies on the Vandermonde matrices
+ *   gbf_decode() feeds it. Returns 0 (and leaves matrix garbled) if it is singular.
+ */
+extern int gbf_invmatrix_pivot(gbf_int_t *matrix, int size);
+
+
+/* gbf_select_kernel(allow_simd)
+ *   gbf_init() picks the fastest SIMD code the CPU has for encoding and
+ *   decoding. Call this with allow_simd=0 to use the plain C reference code
+ *   instead, or with 1 to go back. Returns the name of what's in use.
+ */
+extern const char *gbf_select_kernel(int allow_simd);
+
+/* gbf_xor_region(dst, src, len)
+ *   dst ^= src, for len bytes. This is addition in the field, and what
+ *   parity FEC does. Usable without gbf_init().
+ */
+extern void gbf_xor_region(void *dst, const void *src, int len);
+
 
 /***************************************************************************
 ** encode and decode methods                                              **
@@ -69,6 +99,11 @@ extern void gbf_invmatrix(gbf_int_t *matrix, int size);
  */
 extern void gbf_encode_one(gbf_int_t *out, gbf_int_t *data, gbf_int_t vec, int num_frag, int size);
 
+/* gbf_encode(out[num_out][size], vec[num_out], num_out, data[num_frag*size], num_frag, size)
+ *   Same as calling gbf_encode_one() for every vec, but faster.
+ */
+extern void gbf_encode(gbf_int_t **out, const gbf_int_t *vec, int num_out, gbf_int_t *data, int num_frag, int size);
+
 /* gbf_decode(out[num_frag*size], data[num_frag*size], vec[num_frag], num_frag, size)
  *   Decode the original data. <data> contains all concatenated fragments.
  *   <vec> contains all used vector-values (should be in the same order as
@@ -76,4 +111,96 @@ extern void gbf_encode_one(gbf_int_t *out, gbf_int_t *data, gbf_int_t vec, int n
  */
 extern void gbf_decode(gbf_int_t *out, gbf_int_t *data, gbf_int_t *vec, int num_frag, int size);
 
+/* Decoder context: remembers the inverted matrices of the last <entries>
+ * different vec[] sets it saw. Loss patterns repeat a lot, so most stripes
+ * can skip the matrix inversion.
+ */
+typedef struct {
+	int num_frag;
+	int entries;
+	int hits, misses;
+	uint32_t tick;
+	gbf_int_t *vecs;       // [entries][num_frag]
+	gbf_int_t *inv;        // [entries][num_frag*num_frag]
+	uint32_t *last_used;   // [entries], 0 if unused
+	void *own_mem;         // what gbf_decoder_init allocated itself
+} gbf_decoder_t;
+
+/* gbf_decoder_mem(num_frag, entries)
+ *   How many bytes of memory a decoder context needs.
+ */
+extern size_t gbf_decoder_mem(int num_frag, int entries);
+
+/* gbf_decoder_init(d, num_frag, entries, mem)
+ *   Set up the context in <mem>, which is gbf_decoder_mem() bytes and 8-byte
+ *   aligned, or NULL to allocate it. Returns 0 if there's not enough memory.
+ */
+extern int gbf_decoder_init(gbf_decoder_t *d, int num_frag, int entries, void *mem);
+extern void gbf_decoder_free(gbf_decoder_t *d);
+
+/* gbf_decode_ctx(d, out[num_frag*size], data[num_frag*size], vec[num_frag], size)
+ *   gbf_decode(), with the matrix inversion cached in d. d->hits and
+ *   d->misses count how often that worked out.
+ */
+extern void gbf_decode_ctx(gbf_decoder_t *d, gbf_int_t *out, gbf_int_t *data, gbf_int_t *vec, int size);
+
+/* gbf_encode_sys(parity[num_parity][size], num_parity, data[num_frag][size], num_frag, size)
+ *   Systematic encoding: the data fragments themselves are sent as-is, next to
+ *   up to 65536-num_frag parity fragments made here. Any num_frag of data and
+ *   parity fragments are enough to decode.
+ */
+extern void gbf_encode_sys(gbf_int_t **parity, int num_parity, gbf_int_t **data, int num_frag, int size);
+
+/* gbf_decode_sys(data[num_frag][size], present[num_frag], parity[num_parity][size], parity_row[num_parity], num_parity, num_frag, size)
+ *   Recover the data fragments that aren't <present> into their <data> buffers.
+ *   parity[i] is parity fragment number parity_row[i]; as many parity fragments
+ *   as there is data missing get used, and are overwritten while doing so.
+ *   Returns 0 if there isn't enough parity.
+ */
+extern int gbf_decode_sys(gbf_int_t **data, const uint8_t *present, gbf_int_t **parity, const int *parity_row, int num_parity, int num_frag, int size);
+
+/* Progressive decoding of what gbf_encode() makes: every fragment is worked
+ * into the decoder as it comes in, so the work is spread out over the stripe
+ * instead of all happening once the last fragment is there. Each
+ * gbf_prog_add() costs at most one multi-source pass plus num_frag
+ * single-source passes over the fragment.
+ */
+typedef struct {
+	int num_frag;
+	int size, max_size;
+	int rank;
+	gbf_int_t *coef;       // [num_frag][num_frag] rows, plus scratch
+	gbf_int_t **rows;      // [num_frag] fragment data, plus scratch
+	uint8_t *have;         // [num_frag] row j is filled in
+	void *own_mem;         // what gbf_prog_init allocated itself
+} gbf_prog_t;
+
+/* gbf_prog_mem(num_frag, max_size)
+ *   How many bytes of memory a decoder for max_size word fragments needs.
+ */
+extern size_t gbf_prog_mem(int num_frag, int max_size);
+
+/* gbf_prog_init(p, num_frag, max_size, mem)
+ *   Set up the decoder in <mem>, which is gbf_prog_mem() bytes and 8-byte
+ *   aligned, or NULL to allocate it. Returns 0 if there's not enough memory.
+ */
+extern int gbf_prog_init(gbf_prog_t *p, int num_frag, int max_size, void *mem);
+extern void gbf_prog_free(gbf_prog_t *p);
+
+/* gbf_prog_reset(p, size)
+ *   Start on a new stripe of <size> word fragments.
+ */
+extern void gbf_prog_reset(gbf_prog_t *p, int size);
+
+/* gbf_prog_add(p, vec, data[size])
+ *   Add the fragment encoded with <vec>. Returns 0 if it didn't add anything
+ *   new. Once p->rank reaches num_frag, the data can be had.
+ */
+extern int gbf_prog_add(gbf_prog_t *p, gbf_int_t vec, const gbf_int_t *data);
+
+/* gbf_prog_get(p, out[num_frag*size])
+ *   The decoded data, laid out like gbf_decode() does.
+ */
+extern void gbf_prog_get(const gbf_prog_t *p, gbf_int_t *out);
+
 #endif // REDUNDANCY_H
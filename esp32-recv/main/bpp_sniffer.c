@@ -308,7 +308,7 @@ static void parseTask(void *arg) {
 			vTaskDelete(NULL);
 		}
 		int success=chksignRecv(&p->data[0], len-sizeof(RecvedWifiPacket));
-		if (success && needWork==WORK_CAPT_BSSID) {
+		if (success==CHKSIGN_OK && needWork==WORK_CAPT_BSSID) {
 			//Got a bssid that seems to send out valid badge packets. Mark the bssid.
 			memcpy(&validBssId, &p->bssid, sizeof(MacAddr));
 			needWork=WORK_IDLE;
@@ -436,6 +436,8 @@ static void wifiMonTask(void *arg) {
 		defecGetStatus(&fecStNw);
 		fecStNw.packetsInTotal-=fecSt.packetsInTotal;
 		fecStNw.packetsInMissed-=fecSt.packetsInMissed;
+		fecStNw.invCacheHits-=fecSt.invCacheHits;
+		fecStNw.invCacheMisses-=fecSt.invCacheMisses;
 		defecGetStatus(&fecSt);
 		
 		if (fecStNw.packetsInTotal==0) gotZeroPackets++; else gotZeroPackets=0;
@@ -454,6 +456,9 @@ static void wifiMonTask(void *arg) {
 		}
 		int missedPct=fecStNw.packetsInTotal?(fecStNw.packetsInMissed*100)/fecStNw.packetsInTotal:0;
 		printf("wifiMonTask: Of the last %d packets, %d (%d pct) were not received.\n", fecStNw.packetsInTotal, fecStNw.packetsInMissed, missedPct);
+		if (fecStNw.invCacheHits+fecStNw.invCacheMisses) {
+			printf("wifiMonTask: FEC matrix cache: %d hits, %d misses.\n", fecStNw.invCacheHits, fecStNw.invCacheMisses);
+		}
 		if (fecStNw.packetsInTotal<2 || missedPct>35) {
 			//Need to re-scan to see if we can find a better AP.
 			printf("wifiMonTask: Re-scanning for AP...\n");
@@ -15,6 +15,7 @@
 #include "structs.h"
 #include "chksign.h"
 #include "defec.h"
+#include "arena.h"
 #include "serdec.h"
 #include "hldemux.h"
 
@@ -104,8 +105,12 @@ void app_main(void)
 	//Initialize bpp components
 	powerDownMgrInit(doDeepSleep, NULL);
 	chksignInit(defecRecv);
-	defecInit(serdecRecv, 1400);
+	defecInit(serdecRecv, ARENA_MAX_PACKET);
 	serdecInit(hldemuxRecv);
+	//Let stripe descriptors ask the layers above if they need a stripe, before checking it.
+	chksignSetFilter(defecWants);
+	defecSetInterestCb(serdecWants);
+	serdecSetInterestCb(hldemuxWants);
 	
 	//Grab last OTA firmware change ID so we don't redundantly update the OTA region
 	nvs_handle nvsh=NULL;
@@ -0,0 +1,59 @@
+/*
+Generates pubkey_precomp.inc from pubkey.inc: the table ed25519_verify_precomp() needs to
+verify signatures made with our key faster. The table is written for the biggest window;
+receivers pick how much of it they compile in by defining ED25519_PRECOMP_WINDOW.
+*/
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "ed25519.h"
+#include "pubkey.inc"
+
+//Receivers use this window if they don't define one. Fits the table in 7.5K of flash.
+#define DEFAULT_WINDOW 6
+
+static int32_t table[ED25519_PRECOMP_SIZE(ED25519_PRECOMP_MAX_WINDOW)/4];
+
+int main(int argc, char **argv) {
+	char *fname="pubkey_precomp.inc";
+	time_t timer;
+	char buffer[26];
+
+	if (!ed25519_precompute_key(table, public_key, ED25519_PRECOMP_MAX_WINDOW)) {
+		printf("Public key in pubkey.inc is invalid\n");
+		return 1;
+	}
+
+	FILE *f=fopen(fname, "w");
+	if (f==NULL) {
+		printf("Couldn't write to %s\n", fname);
+		return 1;
+	}
+	time(&timer);
+	strftime(buffer, 26, "%Y-%m-%d %H:%M:%S", localtime(&timer));
+	fprintf(f, "//Generated on %s\n", buffer);
+	fprintf(f, "//Precomputed table for ed25519_verify_precomp() with public_key. Define\n");
+	fprintf(f, "//ED25519_PRECOMP_WINDOW (%d-%d) to trade table size for speed.\n", ED25519_PRECOMP_MIN_WINDOW, ED25519_PRECOMP_MAX_WINDOW);
+	fprintf(f, "#ifndef ED25519_PRECOMP_WINDOW\n#define ED25519_PRECOMP_WINDOW %d\n#endif\n", DEFAULT_WINDOW);
+	fprintf(f, "static const int32_t public_key_precomp[]={");
+	//A window one bigger needs twice the entries; the entries for smaller windows come first.
+	int entryLen=ED25519_PRECOMP_SIZE(ED25519_PRECOMP_MIN_WINDOW)/4/(1<<(ED25519_PRECOMP_MIN_WINDOW-2));
+	int entries=0;
+	for (int w=ED25519_PRECOMP_MIN_WINDOW; w<=ED25519_PRECOMP_MAX_WINDOW; w++) {
+		if (w!=ED25519_PRECOMP_MIN_WINDOW) fprintf(f, "\n#if ED25519_PRECOMP_WINDOW>=%d", w);
+		for (; entries<(1<<(w-2)); entries++) {
+			for (int i=0; i<entryLen; i++) {
+				if ((i%10)==0) fprintf(f, "\n");
+				fprintf(f, "%d,", table[entries*entryLen+i]);
+			}
+		}
+		if (w!=ED25519_PRECOMP_MIN_WINDOW) fprintf(f, "\n#endif");
+	}
+	fprintf(f, "\n};\n");
+	fclose(f);
+	printf("Written %s: %d entries.\n", fname, entries);
+	return 0;
+}
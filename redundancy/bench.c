@@ -0,0 +1,142 @@
+/*
+Throughput of gbf_encode and gbf_decode with the multiplication backend redundancy.c was
+built with, for the packet size the server uses. Runs the plain C code first, then whatever
+SIMD kernel gbf_init picked for this CPU, and checks both agree. For decoding, it also shows
+the time a receiver is busy at once: a whole stripe for gbf_decode, and for the progressive
+decoder the packet position within a stripe that takes longest on average.
+
+Run with 'make bench'; that builds and runs this once for every backend, for k=4 n=8.
+Other values can be given as './bench-SPLIT <k> <n>'.
+*/
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "redundancy.h"
+
+#define PKT_WORDS (956/sizeof(gbf_int_t))
+#define MIN_SECS 0.5
+
+static int k=4, n=8;
+static gbf_int_t *data, *coded, *recv, *out, *vec;
+static gbf_int_t **outs, *vecs;
+
+static double now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec+ts.tv_nsec/1e9;
+}
+
+static int run(gbf_int_t *ref) {
+	size_t dataLen=k*PKT_WORDS*sizeof(gbf_int_t);
+	//Encode: all n packets of a stripe, like fec_rs.c does.
+	long stripes=0;
+	double start=now(), secs;
+	do {
+		gbf_encode(outs, vecs, n, data, k, PKT_WORDS);
+		stripes++;
+	} while ((secs=now()-start)<MIN_SECS);
+	printf("  encode k=%d n=%d: %7.1f MB/s\n", k, n, stripes*dataLen/secs/1e6);
+	if (ref!=coded && memcmp(ref, coded, n*PKT_WORDS*sizeof(gbf_int_t))!=0) {
+		printf("Encoded data differs from the reference code!\n");
+		return 1;
+	}
+
+	//Decode from the last k packets, so every output word takes a full row of the inverse.
+	for (int i=0; i<k; i++) {
+		vec[i]=n-k+i+1;
+		memcpy(&recv[i*PKT_WORDS], &coded[(n-k+i)*PKT_WORDS], PKT_WORDS*sizeof(gbf_int_t));
+	}
+	stripes=0;
+	start=now();
+	do {
+		gbf_decode(out, recv, vec, k, PKT_WORDS);
+		stripes++;
+	} while ((secs=now()-start)<MIN_SECS);
+	printf("  decode k=%d n=%d: %7.1f MB/s, %.1f us per stripe\n", k, n, stripes*dataLen/secs/1e6, secs/stripes*1e6);
+	if (memcmp(out, data, dataLen)!=0) {
+		printf("Decoded data does not match!\n");
+		return 1;
+	}
+
+	//Same loss pattern every time, so after the first stripe the inverse comes from the cache.
+	gbf_decoder_t dec;
+	gbf_decoder_init(&dec, k, 16, NULL);
+	stripes=0;
+	start=now();
+	do {
+		gbf_decode_ctx(&dec, out, recv, vec, PKT_WORDS);
+		stripes++;
+	} while ((secs=now()-start)<MIN_SECS);
+	printf("  decode k=%d n=%d: %7.1f MB/s (cached inverse)\n", k, n, stripes*dataLen/secs/1e6);
+	gbf_decoder_free(&dec);
+	if (memcmp(out, data, dataLen)!=0) {
+		printf("Decoded data does not match!\n");
+		return 1;
+	}
+
+	//Progressive: time every packet on its own; the last one includes getting the data out.
+	gbf_prog_t prog;
+	gbf_prog_init(&prog, k, PKT_WORDS, NULL);
+	double posSecs[k];
+	memset(posSecs, 0, sizeof(posSecs));
+	stripes=0;
+	secs=0;
+	do {
+		gbf_prog_reset(&prog, PKT_WORDS);
+		for (int i=0; i<k; i++) {
+			double t=now();
+			gbf_prog_add(&prog, vec[i], &recv[i*PKT_WORDS]);
+			if (i==k-1) gbf_prog_get(&prog, out);
+			t=now()-t;
+			posSecs[i]+=t;
+			secs+=t;
+		}
+		stripes++;
+	} while (secs<MIN_SECS);
+	double worst=0;
+	for (int i=0; i<k; i++) if (posSecs[i]>worst) worst=posSecs[i];
+	printf("  decode k=%d n=%d: %7.1f MB/s (progressive), %.1f us worst packet\n", k, n, stripes*dataLen/secs/1e6, worst/stripes*1e6);
+	gbf_prog_free(&prog);
+	if (memcmp(out, data, dataLen)!=0) {
+		printf("Decoded data does not match!\n");
+		return 1;
+	}
+	return 0;
+}
+
+int main(int argc, char **argv) {
+	if (argc==3) {
+		k=atoi(argv[1]);
+		n=atoi(argv[2]);
+	}
+	if (k<1 || n<k) {
+		printf("Usage: %s [k n]\n", argv[0]);
+		return 1;
+	}
+	data=malloc(k*PKT_WORDS*sizeof(gbf_int_t));
+	coded=malloc(n*PKT_WORDS*sizeof(gbf_int_t));
+	gbf_int_t *ref=malloc(n*PKT_WORDS*sizeof(gbf_int_t));
+	recv=malloc(k*PKT_WORDS*sizeof(gbf_int_t));
+	out=malloc(k*PKT_WORDS*sizeof(gbf_int_t));
+	vec=malloc(k*sizeof(gbf_int_t));
+	outs=malloc(n*sizeof(gbf_int_t*));
+	vecs=malloc(n*sizeof(gbf_int_t));
+	for (int i=0; i<n; i++) {
+		outs[i]=&coded[i*PKT_WORDS];
+		vecs[i]=i+1;
+	}
+	for (int i=0; i<k*PKT_WORDS; i++) data[i]=rand();
+
+	gbf_init(GBF_POLYNOME);
+	printf(" %s:\n", gbf_select_kernel(0));
+	if (run(coded)) return 1;
+	memcpy(ref, coded, n*PKT_WORDS*sizeof(gbf_int_t));
+	const char *simd=gbf_select_kernel(1);
+	if (strcmp(simd, "scalar")!=0) {
+		printf(" %s:\n", simd);
+		if (run(ref)) return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,88 @@
+/*
+Throughput of the GF(2^8) Cauchy bit-matrix code in crs256.c, next to the systematic GF(2^16)
+code in redundancy.c, for the packet size the server uses with it.
+
+Run with 'make bench', or as './bench-crs <k> <n>'.
+*/
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "crs256.h"
+#include "redundancy.h"
+
+#define PKT_LEN 928
+#define MIN_SECS 0.5
+
+static double now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec+ts.tv_nsec/1e9;
+}
+
+int main(int argc, char **argv) {
+	int k=4, n=8;
+	if (argc==3) {
+		k=atoi(argv[1]);
+		n=atoi(argv[2]);
+	}
+	int m=n-k;
+	crs_t crs;
+	if (!crs_init(&crs, k, m)) {
+		printf("Usage: %s [k n], with k<n and n<=256\n", argv[0]);
+		return 1;
+	}
+	gbf_init(GBF_POLYNOME);
+
+	uint8_t *data[k], *orig[k], *parity[m], *par2[m];
+	int rows[m];
+	for (int i=0; i<k; i++) {
+		data[i]=malloc(PKT_LEN);
+		orig[i]=malloc(PKT_LEN);
+		for (int j=0; j<PKT_LEN; j++) orig[i][j]=data[i][j]=rand();
+	}
+	for (int i=0; i<m; i++) {
+		parity[i]=malloc(PKT_LEN);
+		par2[i]=malloc(PKT_LEN);
+		rows[i]=i;
+	}
+	//Lose the first min(k, m) data packets.
+	int lost=(m<k)?m:k;
+	uint8_t present[k];
+	for (int i=0; i<k; i++) present[i]=(i>=lost);
+
+	printf("crs: %d XORs of %d bytes per stripe\n", crs.sched_len, PKT_LEN/8);
+	//The badge has no SIMD, so show the GF(2^16) code without it too.
+	const char *names[]={"crs", "gbf sys", "gbf sys"};
+	for (int code=0; code<3; code++) {
+		char name[32];
+		snprintf(name, sizeof(name), "%s%s%s", names[code], code?" ":"", code?gbf_select_kernel(code==2):"");
+		long stripes=0;
+		double start=now(), secs;
+		do {
+			if (code) gbf_encode_sys((gbf_int_t**)parity, m, (gbf_int_t**)data, k, PKT_LEN/sizeof(gbf_int_t));
+			else crs_encode(&crs, data, parity, PKT_LEN);
+			stripes++;
+		} while ((secs=now()-start)<MIN_SECS);
+		printf("%-16s encode k=%d n=%d: %7.1f MB/s\n", name, k, n, stripes*k*PKT_LEN/secs/1e6);
+
+		stripes=0;
+		int ok=1;
+		start=now();
+		do {
+			for (int i=0; i<m; i++) memcpy(par2[i], parity[i], PKT_LEN);
+			if (code) ok&=gbf_decode_sys((gbf_int_t**)data, present, (gbf_int_t**)par2, rows, m, k, PKT_LEN/sizeof(gbf_int_t));
+			else ok&=crs_decode(&crs, data, present, par2, rows, m, PKT_LEN);
+			stripes++;
+		} while ((secs=now()-start)<MIN_SECS);
+		printf("%-16s decode k=%d n=%d: %7.1f MB/s (%d lost)\n", name, k, n, stripes*k*PKT_LEN/secs/1e6, lost);
+		for (int i=0; i<k; i++) {
+			if (!ok || memcmp(data[i], orig[i], PKT_LEN)!=0) {
+				printf("Decoded data does not match!\n");
+				return 1;
+			}
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,342 @@
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "crs256.h"
+
+// x^8 + x^4 + x^3 + x^2 + 1; x generates the whole group, so log/exp tables work.
+#define CRS_POLYNOME 0x11d
+
+static uint8_t crs_exp[510];
+static uint8_t crs_log[256];
+
+static void
+crs_tables(void)
+{
+	if (crs_exp[0])
+		return;
+	int i, v = 1;
+	for (i=0; i<255; i++)
+	{
+		crs_exp[i] = v;
+		crs_exp[i + 255] = v;
+		crs_log[v] = i;
+		v <<= 1;
+		if (v & 0x100)
+			v ^= CRS_POLYNOME;
+	}
+}
+
+static uint8_t
+crs_mul(uint8_t a, uint8_t b)
+{
+	if (a == 0 || b == 0)
+		return 0;
+	return crs_exp[crs_log[a] + crs_log[b]];
+}
+
+static uint8_t
+crs_inv(uint8_t a)
+{
+	assert(a != 0);
+	return crs_exp[255 - crs_log[a]];
+}
+
+/* Row b of the bit matrix of e: bit c is set if sub-block c of the source goes into
+ * sub-block b of the destination. Column c is e * x^c. */
+static uint8_t
+crs_bitrow(uint8_t e, int b)
+{
+	uint8_t row = 0;
+	int c;
+	for (c=0; c<8; c++)
+		if (crs_mul(e, 1 << c) & (1 << b))
+			row |= 1 << c;
+	return row;
+}
+
+static int
+crs_ones(uint8_t e)
+{
+	int b, n = 0;
+	for (b=0; b<8; b++)
+		n += __builtin_popcount(crs_bitrow(e, b));
+	return n;
+}
+
+// dst ^= src, or dst = src
+static void
+crs_xor(uint8_t *dst, const uint8_t *src, int len, int copy)
+{
+	if (copy)
+	{
+		memcpy(dst, src, len);
+		return;
+	}
+	uint32_t *d = (uint32_t *) dst;
+	const uint32_t *s = (const uint32_t *) src;
+	int i;
+	for (i=0; i<len/4; i++)
+		d[i] ^= s[i];
+}
+
+/* dst ^= e * src, on the sub-blocks. */
+static void
+crs_mul_xor(uint8_t *dst, const uint8_t *src, uint8_t e, int len)
+{
+	int sub = len / 8;
+	int b, c;
+	for (b=0; b<8; b++)
+	{
+		uint8_t row = crs_bitrow(e, b);
+		for (c=0; c<8; c++)
+			if (row & (1 << c))
+				crs_xor(&dst[b*sub], &src[c*sub], sub, 0);
+	}
+}
+
+/* Every sub-block of a parity block is the XOR of the data sub-blocks its bit row selects.
+ * Instead of starting from nothing, a row can also start as a copy of a row of the same
+ * parity block that's already done, and fix up the difference. Take whichever is fewer
+ * XORs (Plank's 'smart scheduling'). */
+static int
+crs_schedule(crs_t *c)
+{
+	int k = c->k;
+	int nbits = k * 8;
+	int nwords = (nbits + 31) / 32;
+	// bit rows of all 8 sub-blocks of one parity block, over all data sub-blocks
+	uint32_t *rows = (uint32_t *) calloc(8 * nwords, sizeof(uint32_t));
+	c->sched = (crs_op_t *) malloc(sizeof(crs_op_t) * c->m * 8 * (nbits + 1));
+	if (rows == NULL || c->sched == NULL)
+	{
+		free(rows);
+		return 0;
+	}
+	c->sched_len = 0;
+
+	int r, b, j, w;
+	for (r=0; r<c->m; r++)
+	{
+		memset(rows, 0, sizeof(uint32_t) * 8 * nwords);
+		for (b=0; b<8; b++)
+		{
+			for (j=0; j<k; j++)
+			{
+				uint8_t row = crs_bitrow(c->matrix[r*k + j], b);
+				int s;
+				for (s=0; s<8; s++)
+					if (row & (1 << s))
+						rows[b*nwords + (j*8 + s)/32] |= 1u << ((j*8 + s) % 32);
+			}
+		}
+		for (b=0; b<8; b++)
+		{
+			uint32_t *row = &rows[b*nwords];
+			int best = -1, cost = 0;
+			for (w=0; w<nwords; w++)
+				cost += __builtin_popcount(row[w]);
+			int p;
+			for (p=0; p<b; p++)
+			{
+				int diff = 1;
+				for (w=0; w<nwords; w++)
+					diff += __builtin_popcount(row[w] ^ rows[p*nwords + w]);
+				if (diff < cost)
+				{
+					cost = diff;
+					best = p;
+				}
+			}
+			int dst = (k + r) * 8 + b;
+			int copy = 1;
+			if (best >= 0)
+			{
+				c->sched[c->sched_len++] = (crs_op_t) { (k + r) * 8 + best, dst, 1 };
+				copy = 0;
+			}
+			int s;
+			for (s=0; s<nbits; s++)
+			{
+				uint32_t bit = 1u << (s % 32);
+				uint32_t want = row[s/32] & bit;
+				uint32_t have = best >= 0 ? rows[best*nwords + s/32] & bit : 0;
+				if (want != have)
+				{
+					c->sched[c->sched_len++] = (crs_op_t) { s, dst, copy };
+					copy = 0;
+				}
+			}
+			assert(!copy); // all-zero bit row can't happen in an invertible matrix
+		}
+	}
+	free(rows);
+	// Allocated for the worst case; give back what wasn't needed.
+	crs_op_t *shrunk = (crs_op_t *) realloc(c->sched, sizeof(crs_op_t) * c->sched_len);
+	if (shrunk != NULL)
+		c->sched = shrunk;
+	return 1;
+}
+
+int
+crs_init(crs_t *c, int k, int m)
+{
+	memset(c, 0, sizeof(*c));
+	if (k < 1 || m < 1 || k + m > 256)
+		return 0;
+	crs_tables();
+	c->k = k;
+	c->m = m;
+	c->matrix = (uint8_t *) malloc(m * k);
+	if (c->matrix == NULL)
+		return 0;
+
+	// Cauchy matrix 1/(x_r + y_j) with x_r = k+r and y_j = j.
+	int r, j;
+	for (r=0; r<m; r++)
+		for (j=0; j<k; j++)
+			c->matrix[r*k + j] = crs_inv((k + r) ^ j);
+
+	// Scaling a column or row keeps it a valid code. Make the first row all ones (identity
+	// bit matrices), then scale every other row to have as few bits set as possible.
+	for (j=0; j<k; j++)
+	{
+		uint8_t f = crs_inv(c->matrix[j]);
+		for (r=0; r<m; r++)
+			c->matrix[r*k + j] = crs_mul(c->matrix[r*k + j], f);
+	}
+	for (r=1; r<m; r++)
+	{
+		int best_ones = -1;
+		uint8_t best = 1;
+		int l;
+		for (l=0; l<k; l++)
+		{
+			uint8_t f = crs_inv(c->matrix[r*k + l]);
+			int ones = 0;
+			for (j=0; j<k; j++)
+				ones += crs_ones(crs_mul(c->matrix[r*k + j], f));
+			if (best_ones < 0 || ones < best_ones)
+			{
+				best_ones = ones;
+				best = f;
+			}
+		}
+		for (j=0; j<k; j++)
+			c->matrix[r*k + j] = crs_mul(c->matrix[r*k + j], best);
+	}
+
+	if (!crs_schedule(c))
+	{
+		crs_free(c);
+		return 0;
+	}
+	return 1;
+}
+
+void
+crs_free(crs_t *c)
+{
+	free(c->matrix);
+	free(c->sched);
+	memset(c, 0, sizeof(*c));
+}
+
+void
+crs_encode(const crs_t *c, uint8_t **data, uint8_t **parity, int len)
+{
+	assert(len % CRS_ALIGN == 0);
+	int sub = len / 8;
+	int i;
+	for (i=0; i<c->sched_len; i++)
+	{
+		const crs_op_t *op = &c->sched[i];
+		int sb = op->src / 8, db = op->dst / 8;
+		const uint8_t *src = (sb < c->k) ? data[sb] : parity[sb - c->k];
+		crs_xor(&parity[db - c->k][(op->dst % 8) * sub], &src[(op->src % 8) * sub], sub, op->copy);
+	}
+}
+
+/* Gauss-Jordan with row pivoting, over GF(2^8). */
+static int
+crs_invmatrix(uint8_t *matrix, uint8_t *inv, int size)
+{
+	int i, j, l;
+	memset(inv, 0, size * size);
+	for (i=0; i<size; i++)
+		inv[i*size + i] = 1;
+	for (i=0; i<size; i++)
+	{
+		for (j=i; j<size; j++)
+			if (matrix[j*size + i])
+				break;
+		if (j == size)
+			return 0;
+		for (l=0; l<size; l++)
+		{
+			uint8_t t = matrix[i*size + l]; matrix[i*size + l] = matrix[j*size + l]; matrix[j*size + l] = t;
+			t = inv[i*size + l]; inv[i*size + l] = inv[j*size + l]; inv[j*size + l] = t;
+		}
+		uint8_t p = crs_inv(matrix[i*size + i]);
+		for (l=0; l<size; l++)
+		{
+			matrix[i*size + l] = crs_mul(matrix[i*size + l], p);
+			inv[i*size + l] = crs_mul(inv[i*size + l], p);
+		}
+		for (j=0; j<size; j++)
+		{
+			uint8_t f = matrix[j*size + i];
+			if (j == i || f == 0)
+				continue;
+			for (l=0; l<size; l++)
+			{
+				matrix[j*size + l] ^= crs_mul(f, matrix[i*size + l]);
+				inv[j*size + l] ^= crs_mul(f, inv[i*size + l]);
+			}
+		}
+	}
+	return 1;
+}
+
+int
+crs_decode(const crs_t *c, uint8_t **data, const uint8_t *present, uint8_t **parity, const int *parity_row, int num_parity, int len)
+{
+	assert(len % CRS_ALIGN == 0);
+	int k = c->k;
+	int i, j, m = 0;
+	int missing[256];
+	for (j=0; j<k; j++)
+		if (!present[j])
+			missing[m++] = j;
+	if (m == 0)
+		return 1;
+	if (m > num_parity)
+		return 0;
+
+	uint8_t *x = (uint8_t *) malloc(2 * m * m);
+	if (x == NULL)
+		return 0;
+	uint8_t *inv = &x[m * m];
+
+	// Take what the data we have contributed out of the first m parity blocks; what's left
+	// is x times the missing data.
+	for (i=0; i<m; i++)
+	{
+		const uint8_t *row = &c->matrix[parity_row[i] * k];
+		for (j=0; j<k; j++)
+			if (present[j])
+				crs_mul_xor(parity[i], data[j], row[j], len);
+		for (j=0; j<m; j++)
+			x[i*m + j] = row[missing[j]];
+	}
+	int ok = crs_invmatrix(x, inv, m);
+	for (i=0; ok && i<m; i++)
+	{
+		uint8_t *out = data[missing[i]];
+		memset(out, 0, len);
+		for (j=0; j<m; j++)
+			crs_mul_xor(out, parity[j], inv[i*m + j], len);
+	}
+	free(x);
+	return ok;
+}
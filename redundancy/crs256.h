@@ -0,0 +1,51 @@
+#ifndef CRS256_H
+#define CRS256_H
+
+#include <stdint.h>
+
+/* Cauchy Reed-Solomon over GF(2^8), as bit matrices.
+ *
+ *   Every block is cut into 8 sub-blocks. A multiplication by a field element
+ *   then is an 8x8 matrix of bits, telling which sub-blocks of the source to
+ *   XOR into which sub-blocks of the destination; no field math is done on the
+ *   data itself. Coding is systematic: the k data blocks are sent as they are,
+ *   next to up to 256-k parity blocks. Any k of them decode.
+ */
+
+// Block lengths need to be a multiple of this.
+#define CRS_ALIGN (8 * sizeof(uint32_t))
+
+typedef struct {
+	uint16_t src;    // block*8 + sub-block; data blocks first, then parity
+	uint16_t dst;
+	uint8_t copy;    // 1: dst = src, 0: dst ^= src
+} crs_op_t;
+
+typedef struct {
+	int k, m;
+	uint8_t *matrix;     // [m][k] parity coefficients
+	crs_op_t *sched;     // what encoding does, in order
+	int sched_len;
+} crs_t;
+
+/* crs_init(c, k, m)
+ *   Set up a code with k data and m parity blocks. Works out the bit
+ *   matrices and the cheapest order of XORs for encoding. Returns 0 if
+ *   k+m > 256 or memory runs out.
+ */
+extern int crs_init(crs_t *c, int k, int m);
+extern void crs_free(crs_t *c);
+
+/* crs_encode(c, data[k][len], parity[m][len], len)
+ */
+extern void crs_encode(const crs_t *c, uint8_t **data, uint8_t **parity, int len);
+
+/* crs_decode(c, data[k][len], present[k], parity[][len], parity_row[], num_parity, len)
+ *   Rebuild the data blocks that aren't <present> into their <data> buffers,
+ *   using parity[i], which is parity block number parity_row[i]. As many parity
+ *   blocks as there is data missing get used, and are overwritten while doing
+ *   so. Returns 0 if there isn't enough parity.
+ */
+extern int crs_decode(const crs_t *c, uint8_t **data, const uint8_t *present, uint8_t **parity, const int *parity_row, int num_parity, int len);
+
+#endif // CRS256_H
@@ -1,10 +1,21 @@
 #include <alloca.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <assert.h>
 
 #include "redundancy.h"
 
+#if GBF_BITS == 16 && !defined(GBF_NO_SIMD)
+#if defined(__x86_64__) || defined(__i386__)
+#define GBF_SIMD_X86
+#include <immintrin.h>
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+#define GBF_SIMD_NEON
+#include <arm_neon.h>
+#endif
+#endif
+
 #define LU_BITS 4
 typedef uint8_t gbf_clmul_t;
 
@@ -14,9 +25,47 @@ typedef uint8_t gbf_clmul_t;
 
 #define MAX_STACK_ALLOC 256
 
+#ifndef GBF_MUL_BACKEND
+#define GBF_MUL_BACKEND GBF_MUL_SPLIT
+#endif
+
+#if GBF_MUL_BACKEND != GBF_MUL_CLMUL && GBF_BITS != 16
+#error "Only the clmul backend supports fields other than GF(2^16)"
+#endif
+
 static gbf_clmul_t gbf_clmul[LU_NUM*LU_NUM];
 static gbf_int_t gbf_clmod[LU_NUM];
 
+#if GBF_MUL_BACKEND == GBF_MUL_LOGEXP
+#define GBF_ORDER ((1<<GBF_BITS)-1)
+static gbf_int_t gbf_log[1<<GBF_BITS];
+static gbf_int_t gbf_exp[2*GBF_ORDER]; // doubled, so log(a)+log(b) needs no modulo
+#endif
+
+static gbf_int_t gbf_mul_clmul(gbf_int_t v1, gbf_int_t v2);
+
+#if defined(GBF_SIMD_X86) || defined(GBF_SIMD_NEON)
+#define GBF_HAVE_SIMD
+/* c times every value of each nibble of a word, split in the low and high byte of the
+ * product, as 16-entry tables for pshufb/tbl. */
+typedef struct {
+	uint8_t lo[4][16];
+	uint8_t hi[4][16];
+} gbf_nibtab_t;
+
+// dst[i] ^= sum_j c[j] * src[j][i], for from <= i < count, with t[j] made for c[j].
+typedef void (*gbf_region_fn)(gbf_int_t *dst, gbf_int_t *const *src, const gbf_nibtab_t *t, int num_src, int from, int count);
+
+static gbf_region_fn gbf_region_simd; // NULL if we use the scalar code
+static void gbf_region_mul_add(gbf_int_t *dst, const gbf_int_t *src, gbf_int_t c, int count);
+static void *gbf_scratch(int bytes);
+
+static gbf_int_t *gbf_enc_coef;     // coefficients gbf_enc_tabs was made for
+static gbf_nibtab_t *gbf_enc_tabs;
+static int gbf_enc_num;
+#endif
+static int gbf_allow_simd = 1;
+
 void
 gbf_init(gbf_int_t polynome)
 {
@@ -63,10 +112,53 @@ gbf_init(gbf_int_t polynome)
 		}
 		gbf_clmod[i] = v;
 	}
+
+#if GBF_MUL_BACKEND == GBF_MUL_LOGEXP
+	// The polynome need not be primitive (GBF_POLYNOME isn't), so x may not generate the
+	// multiplicative group; look for the first element that does.
+	gbf_int_t g;
+	for (g=2; g != 0; g++)
+	{
+		gbf_int_t v = 1;
+		for (i=0; i<GBF_ORDER; i++)
+		{
+			gbf_exp[i] = v;
+			gbf_exp[i + GBF_ORDER] = v;
+			gbf_log[v] = i;
+			v = gbf_mul_clmul(v, g);
+			if (v == 1)
+				break;
+		}
+		if (i == GBF_ORDER - 1)
+			break;
+	}
+	assert(g != 0);
+#endif
+
+#ifdef GBF_HAVE_SIMD
+	gbf_enc_num = 0; // tables depend on the polynome
+#endif
+	gbf_select_kernel(gbf_allow_simd);
 }
 
+#if GBF_MUL_BACKEND == GBF_MUL_LOGEXP
 gbf_int_t
 gbf_mul(gbf_int_t v1, gbf_int_t v2)
+{
+	if (v1 == 0 || v2 == 0)
+		return 0;
+	return gbf_exp[gbf_log[v1] + gbf_log[v2]];
+}
+#else
+gbf_int_t
+gbf_mul(gbf_int_t v1, gbf_int_t v2)
+{
+	return gbf_mul_clmul(v1, v2);
+}
+#endif
+
+static gbf_int_t
+gbf_mul_clmul(gbf_int_t v1, gbf_int_t v2)
 {
 	gbf_int_t p = 0;
 
@@ -212,49 +304,528 @@ gbf_invmatrix(gbf_int_t *matrix, int size)
 	}
 }
 
-void
-gbf_encode_one(gbf_int_t *out, gbf_int_t *data, gbf_int_t vec, int num_frag, int size)
+#if GBF_MUL_BACKEND == GBF_MUL_SPLIT || defined(GBF_HAVE_SIMD)
+/* pow2[i] = c * 2^i, for i < GBF_BITS. */
+static void
+gbf_pow2(gbf_int_t c, gbf_int_t *pow2)
 {
-	assert(vec != 0); // not allowed to use vec 0.
+	int i;
+	pow2[0] = c;
+	for (i=1; i<GBF_BITS; i++)
+		pow2[i] = (pow2[i-1] << 1) ^ ((pow2[i-1] >> (GBF_BITS - 1)) ? gbf_clmod[1] : 0);
+}
+#endif
 
-	gbf_int_t *x;
-	if (sizeof(gbf_int_t) * num_frag > MAX_STACK_ALLOC) {
-		x = (gbf_int_t *) malloc(sizeof(gbf_int_t) * num_frag);
-		assert(x != NULL); // FIXME: have to do this more gracefully
+int
+gbf_invmatrix_pivot(gbf_int_t *matrix, int size)
+{
+	gbf_int_t *inv;
+	if (sizeof(gbf_int_t) * size * size > MAX_STACK_ALLOC) {
+		inv = (gbf_int_t *) malloc(sizeof(gbf_int_t) * size * size);
+		assert(inv != NULL); // FIXME: have to do this more gracefully
 	} else {
-		x = (gbf_int_t *) alloca(sizeof(gbf_int_t) * num_frag);
+		inv = (gbf_int_t *) alloca(sizeof(gbf_int_t) * size * size);
+	}
+
+	int i, j, k;
+	for (i=0; i<size*size; i++)
+		inv[i] = 0;
+	for (i=0; i<size; i++)
+		inv[i*size + i] = 1;
+
+	// Gauss-Jordan; swap in a row with a non-zero pivot whenever needed.
+	int ok = 1;
+	for (i=0; i<size && ok; i++)
+	{
+		for (j=i; j<size; j++)
+			if (matrix[j*size + i] != 0)
+				break;
+		if (j == size)
+		{
+			ok = 0;
+			break;
+		}
+		if (j != i)
+		{
+			for (k=0; k<size; k++)
+			{
+				gbf_int_t t = matrix[i*size + k]; matrix[i*size + k] = matrix[j*size + k]; matrix[j*size + k] = t;
+				t = inv[i*size + k]; inv[i*size + k] = inv[j*size + k]; inv[j*size + k] = t;
+			}
+		}
+		gbf_int_t pinv = gbf_inv(matrix[i*size + i]);
+		for (k=0; k<size; k++)
+		{
+			matrix[i*size + k] = gbf_mul(matrix[i*size + k], pinv);
+			inv[i*size + k] = gbf_mul(inv[i*size + k], pinv);
+		}
+		for (j=0; j<size; j++)
+		{
+			gbf_int_t f = matrix[j*size + i];
+			if (j == i || f == 0)
+				continue;
+			for (k=0; k<size; k++)
+			{
+				matrix[j*size + k] ^= gbf_mul(f, matrix[i*size + k]);
+				inv[j*size + k] ^= gbf_mul(f, inv[i*size + k]);
+			}
+		}
+	}
+	if (ok)
+		for (i=0; i<size*size; i++)
+			matrix[i] = inv[i];
+
+	if (sizeof(gbf_int_t) * size * size > MAX_STACK_ALLOC) {
+		free(inv);
 	}
+	return ok;
+}
 
+/* out[i*ostride] ^= c * in[i*istride], for i < count.
+ *   All bulk work of encoding and decoding goes through here, so this is what the
+ *   backends speed up.
+ */
+#if GBF_MUL_BACKEND == GBF_MUL_LOGEXP
+static void
+gbf_mul_add_region(gbf_int_t *out, int ostride, const gbf_int_t *in, int istride, gbf_int_t c, int count)
+{
+	if (c == 0)
+		return;
+	const gbf_int_t *exp_c = &gbf_exp[gbf_log[c]];
 	int i;
-	x[0] = 1;
-	for (i=1; i<num_frag; i++)
-		x[i] = gbf_mul(x[i-1], vec);
+	for (i=0; i<count; i++)
+	{
+		gbf_int_t v = in[i*istride];
+		if (v)
+			out[i*ostride] ^= exp_c[gbf_log[v]];
+	}
+}
 
-	for (i=0; i<size; i++)
+#elif GBF_MUL_BACKEND == GBF_MUL_SPLIT
+static void
+gbf_mul_add_region(gbf_int_t *out, int ostride, const gbf_int_t *in, int istride, gbf_int_t c, int count)
+{
+	if (c == 0)
+		return;
+	// c times every possible low byte and every possible high byte. Multiplication is linear,
+	// so only c times the powers of two are needed; the rest are sums of those.
+	gbf_int_t lo[256], hi[256];
+	gbf_int_t pow2[16];
+	int i;
+	gbf_pow2(c, pow2);
+	lo[0] = 0;
+	hi[0] = 0;
+	for (i=1; i<256; i++)
 	{
-		int j;
-		gbf_int_t v = 0;
-		for (j=0; j<num_frag; j++)
-			v ^= gbf_mul(*data++, x[j]);
-		*out++ = v;
+		int low = __builtin_ctz(i);
+		lo[i] = lo[i & (i-1)] ^ pow2[low];
+		hi[i] = hi[i & (i-1)] ^ pow2[low + 8];
+	}
+	for (i=0; i<count; i++)
+	{
+		gbf_int_t v = in[i*istride];
+		out[i*ostride] ^= lo[v & 0xff] ^ hi[v >> 8];
 	}
+}
 
-	if (sizeof(gbf_int_t) * num_frag > MAX_STACK_ALLOC) {
-		free(x);
+#else
+static void
+gbf_mul_add_region(gbf_int_t *out, int ostride, const gbf_int_t *in, int istride, gbf_int_t c, int count)
+{
+	int i;
+	for (i=0; i<count; i++)
+		out[i*ostride] ^= gbf_mul_clmul(in[i*istride], c);
+}
+#endif
+
+/***************************************************************************
+** SIMD region kernels                                                    **
+***************************************************************************/
+
+/* These work on contiguous words and split every word in its four nibbles, which are
+ * looked up in 16-entry tables with a byte shuffle (pshufb on x86, tbl on ARM). Which one
+ * to use is decided at runtime; the backend code above stays the reference path.
+ */
+#ifdef GBF_HAVE_SIMD
+static void
+gbf_nibtab_init(gbf_nibtab_t *t, gbf_int_t c)
+{
+	gbf_int_t pow2[16];
+	gbf_pow2(c, pow2);
+	int n, v;
+	for (n=0; n<4; n++)
+	{
+		t->lo[n][0] = 0;
+		t->hi[n][0] = 0;
+		for (v=1; v<16; v++)
+		{
+			gbf_int_t p = pow2[n*4 + __builtin_ctz(v)];
+			t->lo[n][v] = t->lo[n][v & (v-1)] ^ (p & 0xff);
+			t->hi[n][v] = t->hi[n][v & (v-1)] ^ (p >> 8);
+		}
 	}
 }
 
+// For the words the vector kernels leave over at the end.
+static void
+gbf_region_nib_scalar(gbf_int_t *dst, const gbf_int_t *src, const gbf_nibtab_t *t, int count)
+{
+	int i;
+	for (i=0; i<count; i++)
+	{
+		gbf_int_t v = src[i];
+		int lo = t->lo[0][v & 15] ^ t->lo[1][(v >> 4) & 15] ^ t->lo[2][(v >> 8) & 15] ^ t->lo[3][v >> 12];
+		int hi = t->hi[0][v & 15] ^ t->hi[1][(v >> 4) & 15] ^ t->hi[2][(v >> 8) & 15] ^ t->hi[3][v >> 12];
+		dst[i] ^= lo | (hi << 8);
+	}
+}
+#endif
+
+/* The kernels add up all sources for a run of words in registers and only then touch
+ * dst, so every output word is read and written once no matter how many sources. */
+#define GBF_SPLIT_NIBBLES(lo, hi, n0, n1, n2, n3, AND, SRL, nib) \
+	n0 = AND(lo, nib); n1 = AND(SRL(lo, 4), nib); n2 = AND(hi, nib); n3 = AND(SRL(hi, 4), nib)
+
+#ifdef GBF_SIMD_X86
+__attribute__((target("ssse3")))
+static void
+gbf_region_ssse3(gbf_int_t *dst, gbf_int_t *const *src, const gbf_nibtab_t *t, int num_src, int from, int count)
+{
+	const __m128i nib = _mm_set1_epi8(0x0f);
+	const __m128i even = _mm_setr_epi8(0, 2, 4, 6, 8, 10, 12, 14, -1, -1, -1, -1, -1, -1, -1, -1);
+	const __m128i odd = _mm_setr_epi8(1, 3, 5, 7, 9, 11, 13, 15, -1, -1, -1, -1, -1, -1, -1, -1);
+	int i, j;
+	for (i=from; i+16<=count; i+=16)
+	{
+		__m128i rlo = _mm_setzero_si128();
+		__m128i rhi = _mm_setzero_si128();
+		for (j=0; j<num_src; j++)
+		{
+			const __m128i *tlo = (const __m128i *) t[j].lo;
+			const __m128i *thi = (const __m128i *) t[j].hi;
+			__m128i a = _mm_loadu_si128((const __m128i *) &src[j][i]);
+			__m128i b = _mm_loadu_si128((const __m128i *) &src[j][i+8]);
+			// low bytes of 16 words in one register, high bytes in another
+			__m128i lo = _mm_unpacklo_epi64(_mm_shuffle_epi8(a, even), _mm_shuffle_epi8(b, even));
+			__m128i hi = _mm_unpacklo_epi64(_mm_shuffle_epi8(a, odd), _mm_shuffle_epi8(b, odd));
+			__m128i n0, n1, n2, n3;
+			GBF_SPLIT_NIBBLES(lo, hi, n0, n1, n2, n3, _mm_and_si128, _mm_srli_epi16, nib);
+			rlo = _mm_xor_si128(rlo, _mm_xor_si128(_mm_xor_si128(_mm_shuffle_epi8(_mm_loadu_si128(&tlo[0]), n0), _mm_shuffle_epi8(_mm_loadu_si128(&tlo[1]), n1)),
+			                                       _mm_xor_si128(_mm_shuffle_epi8(_mm_loadu_si128(&tlo[2]), n2), _mm_shuffle_epi8(_mm_loadu_si128(&tlo[3]), n3))));
+			rhi = _mm_xor_si128(rhi, _mm_xor_si128(_mm_xor_si128(_mm_shuffle_epi8(_mm_loadu_si128(&thi[0]), n0), _mm_shuffle_epi8(_mm_loadu_si128(&thi[1]), n1)),
+			                                       _mm_xor_si128(_mm_shuffle_epi8(_mm_loadu_si128(&thi[2]), n2), _mm_shuffle_epi8(_mm_loadu_si128(&thi[3]), n3))));
+		}
+		__m128i *d = (__m128i *) &dst[i];
+		_mm_storeu_si128(d, _mm_xor_si128(_mm_loadu_si128(d), _mm_unpacklo_epi8(rlo, rhi)));
+		_mm_storeu_si128(d + 1, _mm_xor_si128(_mm_loadu_si128(d + 1), _mm_unpackhi_epi8(rlo, rhi)));
+	}
+	for (j=0; j<num_src; j++)
+		gbf_region_nib_scalar(&dst[i], &src[j][i], &t[j], count - i);
+}
+
+/* Same as the SSSE3 one, per 128-bit lane. Unpacking per lane puts the words back where
+ * they came from: the low lane gets the first 8 words of each input register. */
+__attribute__((target("avx2")))
+static void
+gbf_region_avx2(gbf_int_t *dst, gbf_int_t *const *src, const gbf_nibtab_t *t, int num_src, int from, int count)
+{
+	const __m256i nib = _mm256_set1_epi8(0x0f);
+	const __m256i even = _mm256_setr_epi8(0, 2, 4, 6, 8, 10, 12, 14, -1, -1, -1, -1, -1, -1, -1, -1,
+	                                      0, 2, 4, 6, 8, 10, 12, 14, -1, -1, -1, -1, -1, -1, -1, -1);
+	const __m256i odd = _mm256_setr_epi8(1, 3, 5, 7, 9, 11, 13, 15, -1, -1, -1, -1, -1, -1, -1, -1,
+	                                     1, 3, 5, 7, 9, 11, 13, 15, -1, -1, -1, -1, -1, -1, -1, -1);
+	int i, j;
+	for (i=from; i+32<=count; i+=32)
+	{
+		__m256i rlo = _mm256_setzero_si256();
+		__m256i rhi = _mm256_setzero_si256();
+		for (j=0; j<num_src; j++)
+		{
+			const __m128i *tlo = (const __m128i *) t[j].lo;
+			const __m128i *thi = (const __m128i *) t[j].hi;
+			__m256i a = _mm256_loadu_si256((const __m256i *) &src[j][i]);
+			__m256i b = _mm256_loadu_si256((const __m256i *) &src[j][i+16]);
+			__m256i lo = _mm256_unpacklo_epi64(_mm256_shuffle_epi8(a, even), _mm256_shuffle_epi8(b, even));
+			__m256i hi = _mm256_unpacklo_epi64(_mm256_shuffle_epi8(a, odd), _mm256_shuffle_epi8(b, odd));
+			__m256i n0, n1, n2, n3;
+			GBF_SPLIT_NIBBLES(lo, hi, n0, n1, n2, n3, _mm256_and_si256, _mm256_srli_epi16, nib);
+#define TAB(p) _mm256_broadcastsi128_si256(_mm_loadu_si128(p))
+			rlo = _mm256_xor_si256(rlo, _mm256_xor_si256(_mm256_xor_si256(_mm256_shuffle_epi8(TAB(&tlo[0]), n0), _mm256_shuffle_epi8(TAB(&tlo[1]), n1)),
+			                                             _mm256_xor_si256(_mm256_shuffle_epi8(TAB(&tlo[2]), n2), _mm256_shuffle_epi8(TAB(&tlo[3]), n3))));
+			rhi = _mm256_xor_si256(rhi, _mm256_xor_si256(_mm256_xor_si256(_mm256_shuffle_epi8(TAB(&thi[0]), n0), _mm256_shuffle_epi8(TAB(&thi[1]), n1)),
+			                                             _mm256_xor_si256(_mm256_shuffle_epi8(TAB(&thi[2]), n2), _mm256_shuffle_epi8(TAB(&thi[3]), n3))));
+#undef TAB
+		}
+		__m256i *d = (__m256i *) &dst[i];
+		_mm256_storeu_si256(d, _mm256_xor_si256(_mm256_loadu_si256(d), _mm256_unpacklo_epi8(rlo, rhi)));
+		_mm256_storeu_si256(d + 1, _mm256_xor_si256(_mm256_loadu_si256(d + 1), _mm256_unpackhi_epi8(rlo, rhi)));
+	}
+	gbf_region_ssse3(dst, src, t, num_src, i, count);
+}
+#endif
+
+#ifdef GBF_SIMD_NEON
+static void
+gbf_region_neon(gbf_int_t *dst, gbf_int_t *const *src, const gbf_nibtab_t *t, int num_src, int from, int count)
+{
+	const uint8x16_t nib = vdupq_n_u8(0x0f);
+	int i, j;
+	for (i=from; i+16<=count; i+=16)
+	{
+		uint8x16_t rlo = vdupq_n_u8(0);
+		uint8x16_t rhi = vdupq_n_u8(0);
+		for (j=0; j<num_src; j++)
+		{
+			// vld2 splits the low and high bytes for us
+			uint8x16x2_t v = vld2q_u8((const uint8_t *) &src[j][i]);
+			uint8x16_t n0, n1, n2, n3;
+			GBF_SPLIT_NIBBLES(v.val[0], v.val[1], n0, n1, n2, n3, vandq_u8, vshrq_n_u8, nib);
+			rlo = veorq_u8(rlo, veorq_u8(veorq_u8(vqtbl1q_u8(vld1q_u8(t[j].lo[0]), n0), vqtbl1q_u8(vld1q_u8(t[j].lo[1]), n1)),
+			                             veorq_u8(vqtbl1q_u8(vld1q_u8(t[j].lo[2]), n2), vqtbl1q_u8(vld1q_u8(t[j].lo[3]), n3))));
+			rhi = veorq_u8(rhi, veorq_u8(veorq_u8(vqtbl1q_u8(vld1q_u8(t[j].hi[0]), n0), vqtbl1q_u8(vld1q_u8(t[j].hi[1]), n1)),
+			                             veorq_u8(vqtbl1q_u8(vld1q_u8(t[j].hi[2]), n2), vqtbl1q_u8(vld1q_u8(t[j].hi[3]), n3))));
+		}
+		uint8x16x2_t d = vld2q_u8((const uint8_t *) &dst[i]);
+		d.val[0] = veorq_u8(d.val[0], rlo);
+		d.val[1] = veorq_u8(d.val[1], rhi);
+		vst2q_u8((uint8_t *) &dst[i], d);
+	}
+	for (j=0; j<num_src; j++)
+		gbf_region_nib_scalar(&dst[i], &src[j][i], &t[j], count - i);
+}
+#endif
+
+const char *
+gbf_select_kernel(int allow_simd)
+{
+	gbf_allow_simd = allow_simd;
+#ifdef GBF_HAVE_SIMD
+	gbf_region_simd = NULL;
+	if (allow_simd)
+	{
+#ifdef GBF_SIMD_X86
+		__builtin_cpu_init();
+		if (__builtin_cpu_supports("avx2"))
+		{
+			gbf_region_simd = gbf_region_avx2;
+			return "avx2";
+		}
+		if (__builtin_cpu_supports("ssse3"))
+		{
+			gbf_region_simd = gbf_region_ssse3;
+			return "ssse3";
+		}
+#else
+		gbf_region_simd = gbf_region_neon;
+		return "neon";
+#endif
+	}
+#endif
+	return "scalar";
+}
+
+#ifdef GBF_HAVE_SIMD
+static void
+gbf_region_mul_add(gbf_int_t *dst, const gbf_int_t *src, gbf_int_t c, int count)
+{
+	if (c == 0)
+		return;
+	gbf_nibtab_t t;
+	gbf_nibtab_init(&t, c);
+	gbf_region_simd(dst, (gbf_int_t **) &src, &t, 1, 0, count);
+}
+
+// Work buffer for rearranging words and keeping tables for the kernels; grows as needed and
+// is never freed.
+static void *
+gbf_scratch(int bytes)
+{
+	static void *buf;
+	static int len;
+	if (bytes > len)
+	{
+		free(buf);
+		buf = malloc(bytes);
+		assert(buf != NULL); // FIXME: have to do this more gracefully
+		len = bytes;
+	}
+	return buf;
+}
+#endif
+
+// dst[i] ^= c * src[i], for i < count, with whatever code is fastest.
+static void
+gbf_mul_add(gbf_int_t *dst, const gbf_int_t *src, gbf_int_t c, int count)
+{
+#ifdef GBF_HAVE_SIMD
+	if (gbf_region_simd)
+	{
+		gbf_region_mul_add(dst, src, c, count);
+		return;
+	}
+#endif
+	gbf_mul_add_region(dst, 1, src, 1, c, count);
+}
+
 void
-gbf_decode(gbf_int_t *out, gbf_int_t *data, gbf_int_t *vec, int num_frag, int size)
+gbf_xor_region(void *dst, const void *src, int len)
+{
+	uint8_t *d = (uint8_t *) dst;
+	const uint8_t *s = (const uint8_t *) src;
+	int i = 0;
+#if defined(GBF_SIMD_X86) && defined(__SSE2__)
+	if (gbf_allow_simd)
+	{
+		for (; i+16<=len; i+=16)
+		{
+			__m128i v = _mm_xor_si128(_mm_loadu_si128((const __m128i *) &d[i]), _mm_loadu_si128((const __m128i *) &s[i]));
+			_mm_storeu_si128((__m128i *) &d[i], v);
+		}
+	}
+#elif defined(GBF_SIMD_NEON)
+	if (gbf_allow_simd)
+	{
+		for (; i+16<=len; i+=16)
+			vst1q_u8(&d[i], veorq_u8(vld1q_u8(&d[i]), vld1q_u8(&s[i])));
+	}
+#endif
+	for (; i+8<=len; i+=8)
+	{
+		uint64_t a, b;
+		memcpy(&a, &d[i], 8);
+		memcpy(&b, &s[i], 8);
+		a ^= b;
+		memcpy(&d[i], &a, 8);
+	}
+	for (; i<len; i++)
+		d[i] ^= s[i];
+}
+
+#define GBF_L1_BYTES 32768
+
+#ifdef GBF_HAVE_SIMD
+/* Kernel tables for a coefficient matrix. Encoders use the same coefficients for every
+ * stripe, so the tables of the last matrix are kept. */
+static gbf_nibtab_t *
+gbf_encode_tables(const gbf_int_t *coef, int num)
+{
+	if (num != gbf_enc_num || memcmp(coef, gbf_enc_coef, sizeof(gbf_int_t) * num) != 0)
+	{
+		free(gbf_enc_coef);
+		free(gbf_enc_tabs);
+		gbf_enc_coef = (gbf_int_t *) malloc(sizeof(gbf_int_t) * num);
+		gbf_enc_tabs = (gbf_nibtab_t *) malloc(sizeof(gbf_nibtab_t) * num);
+		assert(gbf_enc_coef != NULL && gbf_enc_tabs != NULL); // FIXME: have to do this more gracefully
+		memcpy(gbf_enc_coef, coef, sizeof(gbf_int_t) * num);
+		int i;
+		for (i=0; i<num; i++)
+			gbf_nibtab_init(&gbf_enc_tabs[i], coef[i]);
+		gbf_enc_num = num;
+	}
+	return gbf_enc_tabs;
+}
+#endif
+
+/* out[o] = sum_j coef[o*num_frag + j] * fragment j, for o < num_out.
+ *   The fragments are either interleaved word by word in <data> (frags NULL) or each in
+ *   their own buffer. The SIMD code makes every output in one pass over the input, in
+ *   tiles that stay in L1 while all outputs are made from them.
+ */
+static void
+gbf_encode_matrix(gbf_int_t **out, int num_out, gbf_int_t *coef, gbf_int_t *data, gbf_int_t **frags, int num_frag, int size)
+{
+	int o, j, i;
+#ifdef GBF_HAVE_SIMD
+	if (gbf_region_simd)
+	{
+		gbf_nibtab_t *tabs = gbf_encode_tables(coef, num_out * num_frag);
+		// Tiles small enough that num_frag of them plus an output tile fit in L1. Packets are
+		// small enough that a stripe usually is a single tile anyway.
+		int tile = (GBF_L1_BYTES / sizeof(gbf_int_t) / (num_frag + 1)) & ~31;
+		if (tile < 64)
+			tile = 64;
+		gbf_int_t **src = (gbf_int_t **) gbf_scratch(sizeof(gbf_int_t *) * num_frag + (data ? sizeof(gbf_int_t) * num_frag * tile : 0));
+		gbf_int_t *buf = (gbf_int_t *) &src[num_frag];
+
+		int t;
+		for (t=0; t<size; t+=tile)
+		{
+			int n = (size - t < tile) ? size - t : tile;
+			for (j=0; j<num_frag; j++)
+			{
+				if (data)
+				{
+					// The kernels want each fragment in one piece.
+					for (i=0; i<n; i++)
+						buf[j*tile + i] = data[(t+i)*num_frag + j];
+					src[j] = &buf[j*tile];
+				}
+				else
+				{
+					src[j] = &frags[j][t];
+				}
+			}
+			for (o=0; o<num_out; o++)
+			{
+				memset(&out[o][t], 0, sizeof(gbf_int_t) * n);
+				gbf_region_simd(&out[o][t], src, &tabs[o*num_frag], num_frag, 0, n);
+			}
+		}
+		return;
+	}
+#endif
+	for (o=0; o<num_out; o++)
+	{
+		for (i=0; i<size; i++)
+			out[o][i] = 0;
+		for (j=0; j<num_frag; j++)
+		{
+			if (data)
+				gbf_mul_add_region(out[o], 1, &data[j], num_frag, coef[o*num_frag + j], size);
+			else
+				gbf_mul_add_region(out[o], 1, frags[j], 1, coef[o*num_frag + j], size);
+		}
+	}
+}
+
+void
+gbf_encode(gbf_int_t **out, const gbf_int_t *vec, int num_out, gbf_int_t *data, int num_frag, int size)
 {
 	gbf_int_t *x;
-	if (sizeof(gbf_int_t) * num_frag * num_frag > MAX_STACK_ALLOC) {
-		x = (gbf_int_t *) malloc(sizeof(gbf_int_t) * num_frag * num_frag);
+	if (sizeof(gbf_int_t) * num_out * num_frag > MAX_STACK_ALLOC) {
+		x = (gbf_int_t *) malloc(sizeof(gbf_int_t) * num_out * num_frag);
 		assert(x != NULL); // FIXME: have to do this more gracefully
 	} else {
-		x = (gbf_int_t *) alloca(sizeof(gbf_int_t) * num_frag * num_frag);
+		x = (gbf_int_t *) alloca(sizeof(gbf_int_t) * num_out * num_frag);
+	}
+
+	int o, i;
+	for (o=0; o<num_out; o++)
+	{
+		assert(vec[o] != 0); // not allowed to use vec 0.
+		x[o*num_frag] = 1;
+		for (i=1; i<num_frag; i++)
+			x[o*num_frag + i] = gbf_mul(x[o*num_frag + i-1], vec[o]);
 	}
 
+	// Fragment j is every num_frag'th word, starting at word j.
+	gbf_encode_matrix(out, num_out, x, data, NULL, num_frag, size);
+
+	if (sizeof(gbf_int_t) * num_out * num_frag > MAX_STACK_ALLOC) {
+		free(x);
+	}
+}
+
+void
+gbf_encode_one(gbf_int_t *out, gbf_int_t *data, gbf_int_t vec, int num_frag, int size)
+{
+	gbf_encode(&out, &vec, 1, data, num_frag, size);
+}
+
+// The inverse of the Vandermonde matrix for vec, which turns the fragments back into data.
+static void
+gbf_decode_matrix(gbf_int_t *x, const gbf_int_t *vec, int num_frag)
+{
 	int i;
 	for (i=0; i<num_frag; i++)
 	{
@@ -265,21 +836,380 @@ gbf_decode(gbf_int_t *out, gbf_int_t *data, gbf_int_t *vec, int num_frag, int si
 	}
 
 	gbf_invmatrix(x, num_frag);
+}
 
-	for (i=0; i<num_frag; i++)
+static void
+gbf_decode_apply(gbf_int_t *out, gbf_int_t *data, const gbf_int_t *x, int num_frag, int size)
+{
+	int i;
+#ifdef GBF_HAVE_SIMD
+	if (gbf_region_simd)
 	{
-		int j;
-		for (j=0; j<size; j++)
+		// Build every fragment in one piece, then spread it over the output.
+		gbf_nibtab_t *tabs = (gbf_nibtab_t *) gbf_scratch(sizeof(gbf_nibtab_t) * num_frag + sizeof(gbf_int_t *) * num_frag + sizeof(gbf_int_t) * size);
+		gbf_int_t **src = (gbf_int_t **) &tabs[num_frag];
+		gbf_int_t *frag = (gbf_int_t *) &src[num_frag];
+		int j, k;
+		for (k=0; k<num_frag; k++)
+			src[k] = &data[k*size];
+		for (i=0; i<num_frag; i++)
 		{
-			int k;
-			gbf_int_t v = 0;
 			for (k=0; k<num_frag; k++)
-				v ^= gbf_mul(data[k*size + j], x[i*num_frag + k]);
-			out[j*num_frag + i] = v;
+				gbf_nibtab_init(&tabs[k], x[i*num_frag + k]);
+			memset(frag, 0, sizeof(gbf_int_t) * size);
+			gbf_region_simd(frag, src, tabs, num_frag, 0, size);
+			for (j=0; j<size; j++)
+				out[j*num_frag + i] = frag[j];
 		}
+		return;
 	}
+#endif
+	for (i=0; i<num_frag*size; i++)
+		out[i] = 0;
+	for (i=0; i<num_frag; i++)
+	{
+		int k;
+		for (k=0; k<num_frag; k++)
+			gbf_mul_add_region(&out[i], num_frag, &data[k*size], 1, x[i*num_frag + k], size);
+	}
+}
+
+void
+gbf_decode(gbf_int_t *out, gbf_int_t *data, gbf_int_t *vec, int num_frag, int size)
+{
+	gbf_int_t *x;
+	if (sizeof(gbf_int_t) * num_frag * num_frag > MAX_STACK_ALLOC) {
+		x = (gbf_int_t *) malloc(sizeof(gbf_int_t) * num_frag * num_frag);
+		assert(x != NULL); // FIXME: have to do this more gracefully
+	} else {
+		x = (gbf_int_t *) alloca(sizeof(gbf_int_t) * num_frag * num_frag);
+	}
+
+	gbf_decode_matrix(x, vec, num_frag);
+	gbf_decode_apply(out, data, x, num_frag, size);
 
 	if (sizeof(gbf_int_t) * num_frag * num_frag > MAX_STACK_ALLOC) {
 		free(x);
 	}
 }
+
+#define GBF_ALIGN8(x) (((x) + 7) & ~(size_t) 7)
+
+#define GBF_DEC_VECS(n, e) GBF_ALIGN8(sizeof(gbf_int_t) * (n) * (e))
+#define GBF_DEC_INV(n, e) GBF_ALIGN8(sizeof(gbf_int_t) * (n) * (n) * (e))
+#define GBF_DEC_USED(e) GBF_ALIGN8(sizeof(uint32_t) * (e))
+
+size_t
+gbf_decoder_mem(int num_frag, int entries)
+{
+	return GBF_DEC_VECS(num_frag, entries) + GBF_DEC_INV(num_frag, entries) + GBF_DEC_USED(entries);
+}
+
+int
+gbf_decoder_init(gbf_decoder_t *d, int num_frag, int entries, void *mem)
+{
+	memset(d, 0, sizeof(*d));
+	if (mem == NULL)
+	{
+		mem = malloc(gbf_decoder_mem(num_frag, entries));
+		if (mem == NULL)
+			return 0;
+		d->own_mem = mem;
+	}
+	uint8_t *m = (uint8_t *) mem;
+	d->vecs = (gbf_int_t *) m;
+	m += GBF_DEC_VECS(num_frag, entries);
+	d->inv = (gbf_int_t *) m;
+	m += GBF_DEC_INV(num_frag, entries);
+	d->last_used = (uint32_t *) m;
+	memset(d->last_used, 0, sizeof(uint32_t) * entries);
+	d->num_frag = num_frag;
+	d->entries = entries;
+	return 1;
+}
+
+void
+gbf_decoder_free(gbf_decoder_t *d)
+{
+	free(d->own_mem);
+	memset(d, 0, sizeof(*d));
+}
+
+void
+gbf_decode_ctx(gbf_decoder_t *d, gbf_int_t *out, gbf_int_t *data, gbf_int_t *vec, int size)
+{
+	int num_frag = d->num_frag;
+	int i, victim = 0;
+	d->tick++;
+	for (i=0; i<d->entries; i++)
+	{
+		if (d->last_used[i] == 0)
+		{
+			// Entries get filled from the start, so there's nothing after this one.
+			victim = i;
+			break;
+		}
+		if (memcmp(&d->vecs[i*num_frag], vec, sizeof(gbf_int_t) * num_frag) == 0)
+		{
+			d->hits++;
+			d->last_used[i] = d->tick;
+			gbf_decode_apply(out, data, &d->inv[i*num_frag*num_frag], num_frag, size);
+			return;
+		}
+		if (d->last_used[i] < d->last_used[victim])
+			victim = i;
+	}
+
+	d->misses++;
+	gbf_int_t *x = &d->inv[victim*num_frag*num_frag];
+	memcpy(&d->vecs[victim*num_frag], vec, sizeof(gbf_int_t) * num_frag);
+	d->last_used[victim] = d->tick;
+	gbf_decode_matrix(x, vec, num_frag);
+	gbf_decode_apply(out, data, x, num_frag, size);
+}
+
+/* Systematic code: the data fragments go out as they are, parity fragment r is
+ * sum_j data[j] / ((num_frag + r) + j). Every square submatrix of a Cauchy matrix like
+ * that is invertible, so any num_frag of data+parity fragments are enough to decode.
+ */
+static gbf_int_t
+gbf_cauchy(int row, int col, int num_frag)
+{
+	return gbf_inv((gbf_int_t) (num_frag + row) ^ (gbf_int_t) col);
+}
+
+void
+gbf_encode_sys(gbf_int_t **parity, int num_parity, gbf_int_t **data, int num_frag, int size)
+{
+	gbf_int_t *x;
+	if (sizeof(gbf_int_t) * num_parity * num_frag > MAX_STACK_ALLOC) {
+		x = (gbf_int_t *) malloc(sizeof(gbf_int_t) * num_parity * num_frag);
+		assert(x != NULL); // FIXME: have to do this more gracefully
+	} else {
+		x = (gbf_int_t *) alloca(sizeof(gbf_int_t) * num_parity * num_frag);
+	}
+
+	int r, j;
+	for (r=0; r<num_parity; r++)
+		for (j=0; j<num_frag; j++)
+			x[r*num_frag + j] = gbf_cauchy(r, j, num_frag);
+	gbf_encode_matrix(parity, num_parity, x, NULL, data, num_frag, size);
+
+	if (sizeof(gbf_int_t) * num_parity * num_frag > MAX_STACK_ALLOC) {
+		free(x);
+	}
+}
+
+int
+gbf_decode_sys(gbf_int_t **data, const uint8_t *present, gbf_int_t **parity, const int *parity_row, int num_parity, int num_frag, int size)
+{
+	int *missing;
+	if (sizeof(int) * num_frag > MAX_STACK_ALLOC) {
+		missing = (int *) malloc(sizeof(int) * num_frag);
+		assert(missing != NULL); // FIXME: have to do this more gracefully
+	} else {
+		missing = (int *) alloca(sizeof(int) * num_frag);
+	}
+
+	int i, j, m = 0;
+	for (j=0; j<num_frag; j++)
+		if (!present[j])
+			missing[m++] = j;
+
+	int ok = (m <= num_parity);
+	if (ok && m > 0)
+	{
+		gbf_int_t *x;
+		if (sizeof(gbf_int_t) * m * m > MAX_STACK_ALLOC) {
+			x = (gbf_int_t *) malloc(sizeof(gbf_int_t) * m * m);
+			assert(x != NULL); // FIXME: have to do this more gracefully
+		} else {
+			x = (gbf_int_t *) alloca(sizeof(gbf_int_t) * m * m);
+		}
+
+		// Take what the data we have contributed out of the first m parity fragments; what's
+		// left is x times the missing data.
+		for (i=0; i<m; i++)
+		{
+			for (j=0; j<num_frag; j++)
+				if (present[j])
+					gbf_mul_add(parity[i], data[j], gbf_cauchy(parity_row[i], j, num_frag), size);
+			for (j=0; j<m; j++)
+				x[i*m + j] = gbf_cauchy(parity_row[i], missing[j], num_frag);
+		}
+		ok = gbf_invmatrix_pivot(x, m);
+		for (i=0; ok && i<m; i++)
+		{
+			gbf_int_t *out = data[missing[i]];
+			for (j=0; j<size; j++)
+				out[j] = 0;
+			for (j=0; j<m; j++)
+				gbf_mul_add(out, parity[j], x[i*m + j], size);
+		}
+
+		if (sizeof(gbf_int_t) * m * m > MAX_STACK_ALLOC) {
+			free(x);
+		}
+	}
+
+	if (sizeof(int) * num_frag > MAX_STACK_ALLOC) {
+		free(missing);
+	}
+	return ok;
+}
+
+// dst = sum_i coef[i] * src[i], for count words.
+static void
+gbf_sum_region(gbf_int_t *dst, gbf_int_t *const *src, const gbf_int_t *coef, int num_src, int count)
+{
+	int i;
+	for (i=0; i<count; i++)
+		dst[i] = 0;
+#ifdef GBF_HAVE_SIMD
+	if (gbf_region_simd)
+	{
+		gbf_nibtab_t *tabs = (gbf_nibtab_t *) gbf_scratch(sizeof(gbf_nibtab_t) * num_src);
+		for (i=0; i<num_src; i++)
+			gbf_nibtab_init(&tabs[i], coef[i]);
+		gbf_region_simd(dst, src, tabs, num_src, 0, count);
+		return;
+	}
+#endif
+	for (i=0; i<num_src; i++)
+		gbf_mul_add_region(dst, 1, src[i], 1, coef[i], count);
+}
+
+// One extra coefficient row, and room for the sources of a reduction.
+#define GBF_PROG_COEF(n) GBF_ALIGN8(sizeof(gbf_int_t) * ((n) + 2) * ((n) + 1))
+#define GBF_PROG_ROWS(n) GBF_ALIGN8(sizeof(gbf_int_t *) * ((n) * 2 + 1))
+#define GBF_PROG_HAVE(n) GBF_ALIGN8(n)
+
+size_t
+gbf_prog_mem(int num_frag, int max_size)
+{
+	return GBF_PROG_COEF(num_frag) + GBF_PROG_ROWS(num_frag) + GBF_PROG_HAVE(num_frag)
+		+ (size_t) num_frag * GBF_ALIGN8(sizeof(gbf_int_t) * max_size);
+}
+
+int
+gbf_prog_init(gbf_prog_t *p, int num_frag, int max_size, void *mem)
+{
+	int i;
+	memset(p, 0, sizeof(*p));
+	if (mem == NULL)
+	{
+		mem = malloc(gbf_prog_mem(num_frag, max_size));
+		if (mem == NULL)
+			return 0;
+		p->own_mem = mem;
+	}
+	uint8_t *m = (uint8_t *) mem;
+	p->num_frag = num_frag;
+	p->max_size = max_size;
+	p->coef = (gbf_int_t *) m;
+	m += GBF_PROG_COEF(num_frag);
+	p->rows = (gbf_int_t **) m;
+	m += GBF_PROG_ROWS(num_frag);
+	p->have = m;
+	m += GBF_PROG_HAVE(num_frag);
+	for (i=0; i<num_frag; i++)
+	{
+		p->rows[i] = (gbf_int_t *) m;
+		m += GBF_ALIGN8(sizeof(gbf_int_t) * max_size);
+	}
+	gbf_prog_reset(p, max_size);
+	return 1;
+}
+
+void
+gbf_prog_free(gbf_prog_t *p)
+{
+	free(p->own_mem);
+	memset(p, 0, sizeof(*p));
+}
+
+void
+gbf_prog_reset(gbf_prog_t *p, int size)
+{
+	p->size = (size < p->max_size) ? size : p->max_size;
+	p->rank = 0;
+	memset(p->have, 0, p->num_frag);
+}
+
+/* The stored rows are kept in reduced row echelon form: row j has a 1 in column j
+ * and a 0 in the column of every other stored row. Reducing a new fragment
+ * against them is one pass over the data, with the coefficients known up front;
+ * then its own pivot column is cleared out of the others. When the last row
+ * comes in, the rows are the data fragments.
+ */
+int
+gbf_prog_add(gbf_prog_t *p, gbf_int_t vec, const gbf_int_t *data)
+{
+	int k = p->num_frag;
+	int i, j, q;
+	gbf_int_t *r = &p->coef[k*k];
+	gbf_int_t *c = &p->coef[(k+1)*k];
+	gbf_int_t **src = &p->rows[k];
+	if (p->rank == k)
+		return 0;
+
+	r[0] = 1;
+	for (j=1; j<k; j++)
+		r[j] = gbf_mul(r[j-1], vec);
+
+	// Subtract the stored rows; c[] and src[] remember what got subtracted.
+	int n = 1;
+	for (j=0; j<k; j++)
+	{
+		if (!p->have[j] || r[j] == 0)
+			continue;
+		gbf_int_t f = r[j];
+		for (i=0; i<k; i++)
+			r[i] ^= gbf_mul(f, p->coef[j*k + i]);
+		c[n] = f;
+		src[n] = p->rows[j];
+		n++;
+	}
+	for (q=0; q<k && r[q]==0; q++)
+		;
+	if (q == k)
+		return 0;
+
+	// Scale so the pivot becomes 1, and fold that into the pass over the data.
+	gbf_int_t inv = gbf_inv(r[q]);
+	for (i=0; i<k; i++)
+		r[i] = gbf_mul(r[i], inv);
+	c[0] = inv;
+	src[0] = (gbf_int_t *) data;
+	for (i=1; i<n; i++)
+		c[i] = gbf_mul(c[i], inv);
+	gbf_int_t *y = p->rows[q];
+	gbf_sum_region(y, src, c, n, p->size);
+	memcpy(&p->coef[q*k], r, sizeof(gbf_int_t) * k);
+
+	for (j=0; j<k; j++)
+	{
+		gbf_int_t e = p->coef[j*k + q];
+		if (!p->have[j] || e == 0)
+			continue;
+		for (i=0; i<k; i++)
+			p->coef[j*k + i] ^= gbf_mul(e, r[i]);
+		gbf_mul_add(p->rows[j], y, e, p->size);
+	}
+	p->have[q] = 1;
+	p->rank++;
+	return 1;
+}
+
+void
+gbf_prog_get(const gbf_prog_t *p, gbf_int_t *out)
+{
+	int k = p->num_frag;
+	int i, j;
+	for (j=0; j<k; j++)
+	{
+		const gbf_int_t *f = p->rows[j];
+		for (i=0; i<p->size; i++)
+			out[i*k + j] = f[i];
+	}
+}
@@ -0,0 +1,70 @@
+/*
+Benchmark: push a mix of HL packets through the send stack (hlmux, serdes, fec, sign) into a
+sink that just counts, and report how many heap allocations that took per on-air packet.
+
+Run with 'make bench'. Allocations are counted by wrapping malloc at link time.
+*/
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "sendif.h"
+#include "fec.h"
+#include "sign.h"
+#include "serdes.h"
+#include "hlmux.h"
+#include "structs.h"
+
+static long mallocCalls;
+
+void *__real_malloc(size_t size);
+void *__wrap_malloc(size_t size) {
+	mallocCalls++;
+	return __real_malloc(size);
+}
+
+static long sinkPackets;
+
+static void sinkSend(PktBuf *packet) {
+	uint32_t seq=packet->tailSeq;
+	sinkPackets++;
+	pktbufFree(packet);
+	//Like main does; hlmux keeps track of its packets until they get here.
+	if (seq) hlmuxOnAir(seq);
+}
+
+#define NO_ROUNDS 500
+
+int main(int argc, char **argv) {
+	static uint8_t payload[sizeof(BDPacketChange)+BLOCKDEV_BLKSZ];
+	for (int i=0; i<sizeof(payload); i++) payload[i]=rand();
+
+	signInit(sinkSend, 1024);
+	fecInit(signSend, signGetMaxPacketLength());
+	serdesInit(fecSend, fecGetMaxPacketLength());
+	hlmuxInit(serdesSend, serdesGetMaxPacketLength());
+
+	//Warm up, so pools and such are filled.
+	for (int i=0; i<10; i++) hlmuxSend(HLPACKET_TYPE_BDSYNC, BDSYNC_SUBTYPE_CHANGE, payload, sizeof(payload));
+
+	long startMallocs=mallocCalls;
+	long startPackets=sinkPackets;
+	clock_t start=clock();
+	for (int i=0; i<NO_ROUNDS; i++) {
+		//Roughly what a cycle looks like: a block change, a housekeeping packet, a subtitle.
+		hlmuxSend(HLPACKET_TYPE_BDSYNC, BDSYNC_SUBTYPE_CHANGE, payload, sizeof(payload));
+		hlmuxSend(HLPACKET_TYPE_HK, HKPACKET_SUBTYPE_NEXTCATALOG, payload, sizeof(HKPacketNextCatalog));
+		hlmuxSend(HLPACKET_TYPE_SUBTITLES, 0, payload, 40);
+	}
+	double secs=(double)(clock()-start)/CLOCKS_PER_SEC;
+	long mallocs=mallocCalls-startMallocs;
+	long packets=sinkPackets-startPackets;
+
+	PktBufStats st;
+	pktbufGetStats(&st);
+	printf("%d HL packets in, %ld packets out in %.2f s\n", NO_ROUNDS*3, packets, secs);
+	printf("malloc calls: %ld (%.3f per packet out)\n", mallocs, (double)mallocs/packets);
+	printf("pktbuf: %d allocs, %d buffers malloc'ed in total, %d in use\n", st.allocs, st.mallocs, st.inUse);
+	return 0;
+}
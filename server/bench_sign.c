@@ -0,0 +1,66 @@
+/*
+Benchmark: sign packets on 0 (inline), 1, 2, ... worker threads and report signed packets
+per second for each. Also checks the packets come out in the order they went in.
+
+Run with 'make bench'.
+*/
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "sendif.h"
+#include "sign.h"
+#include "structs.h"
+
+#define NO_PACKETS 20000
+#define PACKET_LEN 960 //roughly what fec hands to sign
+
+static uint32_t expectSeq;
+static long outOfOrder;
+static long received;
+
+static void sinkSend(PktBuf *packet) {
+	uint32_t seq;
+	memcpy(&seq, packet->data+sizeof(SignedPacket), sizeof(seq));
+	if (seq!=expectSeq) outOfOrder++;
+	expectSeq=seq+1;
+	received++;
+	pktbufFree(packet);
+}
+
+static double now() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec+ts.tv_nsec/1e9;
+}
+
+static void runBench(int threads) {
+	int started=signSetThreads(threads);
+	expectSeq=0;
+	received=0;
+	outOfOrder=0;
+	double start=now();
+	for (uint32_t i=0; i<NO_PACKETS; i++) {
+		PktBuf *p=pktbufAlloc(PKTBUF_HEADROOM, PACKET_LEN);
+		uint8_t *d=pktbufPut(p, PACKET_LEN);
+		memset(d, i, PACKET_LEN);
+		memcpy(d, &i, sizeof(i));
+		signSend(p);
+		signPoll();
+	}
+	signSetThreads(started); //waits for everything in flight
+	double secs=now()-start;
+	printf("%2d threads: %8.0f packets/s%s\n", started, received/secs, outOfOrder?" (OUT OF ORDER!)":"");
+}
+
+int main(int argc, char **argv) {
+	int cpus=sysconf(_SC_NPROCESSORS_ONLN);
+	signInit(sinkSend, 1024);
+	runBench(0);
+	for (int t=1; t<=cpus; t*=2) runBench(t);
+	if ((cpus&(cpus-1))!=0) runBench(cpus);
+	signSetThreads(0);
+	return 0;
+}
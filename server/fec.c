@@ -19,10 +19,16 @@ parity packet.
 
 extern FecGenerator fecGenParity;
 extern FecGenerator fecGenRs;
+extern FecGenerator fecGenRsSys;
+extern FecGenerator fecGenCrs;
+extern FecGenerator fecGenLt;
 
 static FecGenerator *gens[]={
 	&fecGenRs,
 	&fecGenParity,
+	&fecGenRsSys,
+	&fecGenCrs,
+	&fecGenLt,
 	NULL
 };
 
@@ -30,10 +36,27 @@ static FecGenerator *currGen=NULL;
 
 static int currK, currN;
 
+//Interleaving: the output of depth stripes is collected here, in the order it goes on the air.
+//With stripe descriptors, blocks of one stripe are collected as well, so the descriptor can go
+//out ahead of them.
+static int ilDepth=1;
+static PktBuf **ilBuf;
+static int stripeDesc;
+
 static int sendMaxPktLen;
 static SendCb *sendCb;
 static int serial=0;
 
+//Data packets handed to the generator since the last block boundary, and the earliest deadline
+//among them.
+static int dataPending;
+static uint64_t blockDeadline;
+static PktBufContent blockContent;
+//tailSeq (see PktBuf) of the newest data handed to the generator; every packet that comes out
+//of it gets this, so the layers below can tell what's out there.
+static uint32_t lastSeq;
+static uint64_t padPackets;
+
 static time_t tsLastSaved;
 
 #define TSFILE "lastfecid.txt"
@@ -50,25 +73,93 @@ void fecInit(SendCb *cb, int maxlen) {
 	}
 	if (serial==0) serial=1; //because serial==0 is special
 	tsLastSaved=time(NULL);
+	blockContent.type=PKTBUF_CONTENT_NONE;
 	currGen=gens[0];
 	currK=4;
 	currN=8;
-	currGen->init(currK, currN, maxlen-sizeof(FecPacket));
+	//Start at a stripe boundary, so the generator doesn't have to send dummies to get in sync.
+	if (serial%currN!=0) serial+=currN-serial%currN;
+	currGen->init(currK, currN, fecGetMaxPacketLength());
+}
+
+static void sendStripeDesc(int first, int count) {
+	PktBuf *p=pktbufAlloc(PKTBUF_HEADROOM, sizeof(StripeDesc));
+	StripeDesc *d=(StripeDesc*)pktbufPut(p, sizeof(StripeDesc));
+	d->firstSerial=htonl(first);
+	d->count=htons(count);
+	if (blockContent.type>=0) {
+		d->type=htons(blockContent.type);
+		d->secFirst=htons(blockContent.secFirst);
+		d->secLast=htons(blockContent.secLast);
+	} else {
+		d->type=htons(STRIPEDESC_TYPE_ANY);
+		d->secFirst=0;
+		d->secLast=0;
+	}
+	FecPacket *fp=(FecPacket*)pktbufPush(p, sizeof(FecPacket));
+	fp->serial=htonl(FEC_SERIAL_STRIPEDESC);
+	//Receivers need to be able to trust it before the packets it describes come in.
+	p->signAlone=1;
+	sendCb(p);
+}
+
+//Send what we have of the current block, preceded by its descriptor if those are on.
+static void ilFlush() {
+	int blockLen=ilDepth*currN;
+	int held=0;
+	for (int i=0; i<blockLen; i++) {
+		if (ilBuf[i]) held=1;
+	}
+	if (!held) return;
+	if (stripeDesc) sendStripeDesc(serial-serial%blockLen, blockLen);
+	for (int i=0; i<blockLen; i++) {
+		if (ilBuf[i]) sendCb(ilBuf[i]);
+		ilBuf[i]=NULL;
+	}
 }
 
-uint32_t fecSendFecced(uint8_t *packet, size_t len) {
-	FecPacket *p=malloc(sizeof(FecPacket)+len);
-	p->serial=htonl(serial);
-	memcpy(p->data, packet, len);
-	sendCb((uint8_t*)p, sizeof(FecPacket)+len);
+uint32_t fecSendFecced(PktBuf *packet) {
+	FecPacket *p=(FecPacket*)pktbufPush(packet, sizeof(FecPacket));
+	packet->tailSeq=lastSeq;
+	//Parity is only useful with the data it covers, so it shares the deadline of the block.
+	if (!packet->deadline) packet->deadline=blockDeadline;
+	if (ilBuf==NULL) {
+		p->serial=htonl(serial);
+		sendCb(packet);
+	} else {
+		//Generators see plain consecutive serials; shuffle them so packet i of stripe s
+		//goes out at slot i*depth+s of the block.
+		int blockLen=ilDepth*currN;
+		int slot=serial%blockLen;
+		int airSlot=(slot%currN)*ilDepth+slot/currN;
+		p->serial=htonl(serial-slot+airSlot);
+		ilBuf[airSlot]=packet;
+		if (slot==blockLen-1) ilFlush();
+	}
 	serial++;
-	free(p);
+	if (serial%(ilDepth*currN)==0) {
+		dataPending=0;
+		blockDeadline=0;
+		blockContent.type=PKTBUF_CONTENT_NONE;
+	}
 	return serial;
 }
 
+static void genSend(PktBuf *packet) {
+	dataPending++;
+	if (packet->deadline && (!blockDeadline || packet->deadline<blockDeadline)) blockDeadline=packet->deadline;
+	pktbufContentMerge(&blockContent, &packet->content);
+	if (packet->tailSeq) lastSeq=packet->tailSeq;
+	currGen->send(packet, serial, fecSendFecced);
+}
+
 
-void fecSend(uint8_t *packet, size_t len) {
-	currGen->send(packet, len, serial, fecSendFecced);
+
+void fecSend(PktBuf *packet) {
+	int align=packet->align;
+	if (align&PKTBUF_ALIGN_START) fecFlush();
+	genSend(packet);
+	if (align&PKTBUF_ALIGN_END) fecFlush();
 	//Save timestamp every 10 secs in case of crash/quit
 	if (time(NULL)-tsLastSaved > 10) {
 		FILE *f;
@@ -79,19 +170,100 @@ void fecSend(uint8_t *packet, size_t len) {
 		tsLastSaved=time(NULL);
 
 		//Semi-hack: We use the same timer to send out the FEC parameters
-		FecPacket *p=malloc(sizeof(FecPacket)+sizeof(FecDesc));
-		p->serial=0;
-		FecDesc *dsc=(FecDesc*)p->data;
+		PktBuf *p=pktbufAlloc(PKTBUF_HEADROOM, sizeof(FecDesc));
+		FecDesc *dsc=(FecDesc*)pktbufPut(p, sizeof(FecDesc));
 		dsc->k=htons(currK);
 		dsc->n=htons(currN);
 		dsc->fecAlgoId=currGen->genId;
-		sendCb((uint8_t*)p, sizeof(FecPacket)+sizeof(FecDesc));
-		free(p);
+		dsc->interleave=ilDepth;
+		FecPacket *fp=(FecPacket*)pktbufPush(p, sizeof(FecPacket));
+		fp->serial=0;
+		sendCb(p);
 	}
 }
 
 
+int fecSetGenerator(const char *name, int k, int n, int depth) {
+	FecGenerator *g=NULL;
+	for (int i=0; gens[i]!=NULL; i++) {
+		if (strcmp(gens[i]->name, name)==0) g=gens[i];
+	}
+	if (g==NULL || depth<1 || depth>255) return 0;
+	PktBuf **newIlBuf=NULL;
+	if (depth>1 || stripeDesc) {
+		newIlBuf=calloc(depth*n, sizeof(PktBuf*));
+		if (newIlBuf==NULL) return 0;
+	}
+	currGen->deinit();
+	FecGenerator *old=currGen;
+	currGen=g;
+	if (!g->init(k, n, fecGetMaxPacketLength())) {
+		//Fall back to what we had.
+		currGen=old;
+		currGen->init(currK, currN, fecGetMaxPacketLength());
+		free(newIlBuf);
+		return 0;
+	}
+	if (ilBuf) {
+		ilFlush();
+		free(ilBuf);
+	}
+	ilBuf=newIlBuf;
+	ilDepth=depth;
+	currK=k;
+	currN=n;
+	//Start at a block boundary so the generator and receivers are in sync.
+	if (serial%(depth*n)!=0) serial+=depth*n-serial%(depth*n);
+	dataPending=0;
+	blockDeadline=0;
+	blockContent.type=PKTBUF_CONTENT_NONE;
+	return 1;
+}
+
+void fecSetStripeDesc(int on) {
+	stripeDesc=on;
+	if (on && !ilBuf) {
+		ilBuf=calloc(ilDepth*currN, sizeof(PktBuf*));
+		if (ilBuf==NULL) {
+			perror("fecSetStripeDesc: calloc");
+			exit(1);
+		}
+	} else if (!on && ilBuf && ilDepth==1) {
+		ilFlush();
+		free(ilBuf);
+		ilBuf=NULL;
+	}
+}
+
+//Fill the stripe (with interleaving: the block) with empty packets; receivers skip the zeroes
+//while looking for the next serdes header.
+void fecFlush() {
+	int len=fecGetMaxPacketLength();
+	while (dataPending) {
+		PktBuf *p=pktbufAlloc(PKTBUF_HEADROOM, len);
+		memset(pktbufPut(p, len), 0, len);
+		padPackets++;
+		genSend(p);
+	}
+}
+
+uint64_t fecGetDeadline() {
+	return dataPending?blockDeadline:0;
+}
+
+uint64_t fecGetPadPackets() {
+	return padPackets;
+}
+
+void fecListGenerators() {
+	for (int i=0; gens[i]!=NULL; i++) {
+		printf("  %s: %s\n", gens[i]->name, gens[i]->desc);
+	}
+}
+
 int fecGetMaxPacketLength() {
-	return sendMaxPktLen-sizeof(FecPacket);
+	int len=sendMaxPktLen-sizeof(FecPacket);
+	if (currGen->align) len-=len%currGen->align;
+	return len;
 }
 
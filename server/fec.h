@@ -3,18 +3,20 @@
 
 #include "sendif.h"
 
-//returns new serial
-typedef uint32_t (*FecSendFeccedPacket)(uint8_t *packet, size_t len);
+//returns new serial. Takes ownership of the packet.
+typedef uint32_t (*FecSendFeccedPacket)(PktBuf *packet);
 
 //WARNING: it is assumed that every packet sent through these functions will have length=maxsize
-//Emit n packets out for every k packets in
+//Emit n packets out for every k packets in. Packets handed to the generator are owned by it;
+//packets it creates itself need PKTBUF_HEADROOM.
 typedef int (*FecGeneratorInit)(int k, int n, int maxsize);
-typedef int (*FecGeneratorSend)(uint8_t *packet, size_t len, int serial, FecSendFeccedPacket sendfn);
+typedef int (*FecGeneratorSend)(PktBuf *packet, int serial, FecSendFeccedPacket sendfn);
 typedef void (*FecGeneratorDeinit)();
 typedef struct {
 	const char *name;
 	const char *desc;
 	const int genId;
+	const int align;		//packet length has to be a multiple of this; 0 if it doesn't matter
 	FecGeneratorInit init;
 	FecGeneratorSend send;
 	FecGeneratorDeinit deinit;
@@ -22,7 +24,23 @@ typedef struct {
 
 
 void fecInit(SendCb *cb, int maxlen);
+//Switch to the generator with the given name, interleaving its output over depth stripes
+//(1 for none). Returns 0 if there's no such generator or it can't do k/n; the current one
+//stays in use then. Call this before setting up the layers above:
+//fecGetMaxPacketLength() depends on the generator.
+int fecSetGenerator(const char *name, int k, int n, int depth);
+//Send a signed StripeDesc ahead of every stripe (block, when interleaving). The output of a
+//stripe is then held until it's complete.
+void fecSetStripeDesc(int on);
+void fecListGenerators();
 int fecGetMaxPacketLength();
-void fecSend(uint8_t *packet, size_t len);
+void fecSend(PktBuf *packet);
+//Close the stripe that's being collected (with interleaving: the block) by padding it with
+//empty packets, so what's in it goes out now.
+void fecFlush();
+//Deadline of the open stripe or block (see PktBuf), 0 if there is none.
+uint64_t fecGetDeadline();
+//Empty packets fecFlush() sent.
+uint64_t fecGetPadPackets();
 
 #endif
\ No newline at end of file
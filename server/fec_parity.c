@@ -5,39 +5,49 @@
 #include "sendif.h"
 #include "structs.h"
 #include "fec.h"
+#include "redundancy.h"
 
 
-static uint8_t *parPacket;
+static PktBuf *parPacket;
 static int parM; //after how many packets to send a parity packet
+static int parMaxSize;
 static int biggestLen=0;
 
+//Parity is accumulated straight into the buffer that will be sent out.
+static void newParPacket() {
+	parPacket=pktbufAlloc(PKTBUF_HEADROOM, parMaxSize);
+	memset(parPacket->data, 0, parMaxSize);
+	biggestLen=0;
+}
+
 static int parInit(int k, int n, int maxsize) {
 	if (n!=k+1) return 0;
 	parM=k;
-	parPacket=malloc(maxsize);
-	memset(parPacket, 0, maxsize);
-	biggestLen=0;
+	parMaxSize=maxsize;
+	newParPacket();
 	return 1;
 }
 
-static int parSend(uint8_t *packet, size_t len, int serial, FecSendFeccedPacket sendFn) {
+static int parSend(PktBuf *packet, int serial, FecSendFeccedPacket sendFn) {
 	//Add to parity packet
-	for (int i=0; i<len; i++) parPacket[i]^=packet[i];
-	if (biggestLen<len) biggestLen=len;
+	uint8_t *par=parPacket->data;
+	gbf_xor_region(par, packet->data, packet->len);
+	if (biggestLen<packet->len) biggestLen=packet->len;
 	//Send packet
-	serial=sendFn(packet, len);
+	serial=sendFn(packet);
 	//See if we need to send parity packet
 	int p=serial%(parM+1);
 	if (p==parM) {
-		sendFn(parPacket, biggestLen);
-		memset(parPacket, 0, biggestLen);
-		biggestLen=0;
+		parPacket->len=biggestLen;
+		sendFn(parPacket);
+		newParPacket();
 	}
 	return 1;
 }
 
 static void parDeinit() {
-	free(parPacket);
+	pktbufFree(parPacket);
+	parPacket=NULL;
 	return;
 }
 
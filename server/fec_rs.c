@@ -26,8 +26,8 @@ static int rsInit(int k, int n, int maxsize) {
 	return 1;
 }
 
-static int rsSend(uint8_t *packet, size_t len, int serial, FecSendFeccedPacket sendFn) {
-	assert(len==maxPacketLen);
+static int rsSend(PktBuf *packet, int serial, FecSendFeccedPacket sendFn) {
+	assert(packet->len==maxPacketLen);
 	if (packetsStored==0) {
 		//See if we're still in sync. If not, send a bunch of dummy packets to get in sync.
 		//Shouldn't happen outside maybe a switch to this algo.
@@ -35,25 +35,33 @@ static int rsSend(uint8_t *packet, size_t len, int serial, FecSendFeccedPacket s
 		if (rp!=0) {
 			int toSend=parN-rp;
 			printf("Fec_RS: Out of sync! Need to send %d dummy packets.\n", toSend);
-			memset(packets, 0, maxPacketLen);
-			for (int i=0; i<toSend; i++) serial=sendFn(packets, maxPacketLen);
+			for (int i=0; i<toSend; i++) {
+				PktBuf *d=pktbufAlloc(PKTBUF_HEADROOM, maxPacketLen);
+				memset(pktbufPut(d, maxPacketLen), 0, maxPacketLen);
+				serial=sendFn(d);
+			}
 			assert((serial%parN)==0);
 		}
 	}
 	int p=(serial+packetsStored)%(parN);
 	if (p<parK) {
-		memcpy(&packets[p*maxPacketLen], packet, len);
+		memcpy(&packets[p*maxPacketLen], packet->data, packet->len);
 		packetsStored++;
 	}
+	pktbufFree(packet);
 	if (p==parK-1) {
-		uint8_t *out=malloc(maxPacketLen);
-		//Received last of parK packets. Encode and send.
+		//Received last of parK packets. Encode straight into the outgoing buffers and send.
+		PktBuf *out[parN];
+		gbf_int_t *outData[parN];
+		gbf_int_t vec[parN];
 		for (int i=0; i<parN; i++) {
-			gbf_encode_one((gbf_int_t*)out, (gbf_int_t*) packets, i+1, parK, (maxPacketLen/sizeof(gbf_int_t)));
-			serial=sendFn(out, maxPacketLen);
+			out[i]=pktbufAlloc(PKTBUF_HEADROOM, maxPacketLen);
+			outData[i]=(gbf_int_t*)pktbufPut(out[i], maxPacketLen);
+			vec[i]=i+1;
 		}
+		gbf_encode(outData, vec, parN, (gbf_int_t*) packets, parK, (maxPacketLen/sizeof(gbf_int_t)));
+		for (int i=0; i<parN; i++) serial=sendFn(out[i]);
 		packetsStored=0;
-		free(out);
 	}
 	return 1;
 }
@@ -0,0 +1,158 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include "sendif.h"
+#include "structs.h"
+#include "fec.h"
+#include "redundancy.h"
+#include "crs256.h"
+#include "lt.h"
+
+//Systematic Reed-Solomon: the k data packets of a stripe go out unchanged, right away, followed by
+//n-k parity packets. Receivers that get all data packets don't have to do any math.
+//The parity is either over GF(2^16) (redundancy.c), done as GF(2^8) bit-matrix XORs (crs256.c),
+//or LT fountain code repair symbols (lt.c).
+
+//n is capped: all n-k parity packets of a stripe go out in one go once its last data packet is
+//in, and for RS and CRS they are all in memory at that point.
+#define SYS_MAX_N 1024
+
+static uint8_t *packets;
+static uint8_t **dataPtr;		//k, into packets
+static PktBuf **parBuf;			//n-k; not used for LT, which does one repair packet at a time
+static uint8_t **parData;
+static int packetsStored;
+static int sysK, sysN;
+static int maxPacketLen=0;
+static enum {SYS_RS, SYS_CRS, SYS_LT} sysCode;
+static crs_t crs;
+static lt_t lt;
+
+static int sysInit(int k, int n, int maxsize) {
+	if (n<=k || n>SYS_MAX_N) return 0;
+	sysK=k; sysN=n;
+	packets=malloc(maxsize*k);
+	dataPtr=malloc(sizeof(uint8_t*)*k);
+	parBuf=malloc(sizeof(PktBuf*)*(n-k));
+	parData=malloc(sizeof(uint8_t*)*(n-k));
+	if (packets==NULL || dataPtr==NULL || parBuf==NULL || parData==NULL) {
+		free(packets); free(dataPtr); free(parBuf); free(parData);
+		packets=NULL; dataPtr=NULL; parBuf=NULL; parData=NULL;
+		return 0;
+	}
+	for (int i=0; i<k; i++) dataPtr[i]=&packets[i*maxsize];
+	maxPacketLen=maxsize;
+	packetsStored=0;
+	return 1;
+}
+
+static int rsSysInit(int k, int n, int maxsize) {
+	sysCode=SYS_RS;
+	gbf_init(GBF_POLYNOME);
+	return sysInit(k, n, maxsize);
+}
+
+static int crsInit(int k, int n, int maxsize) {
+	sysCode=SYS_CRS;
+	if (n<=k || maxsize%CRS_ALIGN!=0 || !crs_init(&crs, k, n-k)) return 0;
+	if (!sysInit(k, n, maxsize)) {
+		crs_free(&crs);
+		return 0;
+	}
+	return 1;
+}
+
+//The repair symbols of an LT code don't run out, so a receiver that wakes up halfway a stripe
+//still gets enough of it as long as n-k is generous. Going on 'forever' is just a large n; it is
+//capped at SYS_MAX_N like the others, so a stripe's repairs don't hog the air for too long.
+static int ltInit(int k, int n, int maxsize) {
+	sysCode=SYS_LT;
+	if (n<=k || !lt_init(&lt, k)) return 0;
+	if (!sysInit(k, n, maxsize)) {
+		lt_free(&lt);
+		return 0;
+	}
+	return 1;
+}
+
+static int rsSysSend(PktBuf *packet, int serial, FecSendFeccedPacket sendFn) {
+	assert(packet->len==maxPacketLen);
+	if (packetsStored==0) {
+		//Same as the non-systematic RS code: get in sync with the stripes first.
+		int rp=serial%sysN;
+		if (rp!=0) {
+			int toSend=sysN-rp;
+			printf("Fec_RS_sys: Out of sync! Need to send %d dummy packets.\n", toSend);
+			for (int i=0; i<toSend; i++) {
+				PktBuf *d=pktbufAlloc(PKTBUF_HEADROOM, maxPacketLen);
+				memset(pktbufPut(d, maxPacketLen), 0, maxPacketLen);
+				serial=sendFn(d);
+			}
+			assert((serial%sysN)==0);
+		}
+	}
+	//Keep a copy for the parity, then send the data packet as-is.
+	memcpy(&packets[packetsStored*maxPacketLen], packet->data, packet->len);
+	packetsStored++;
+	serial=sendFn(packet);
+	if (packetsStored==sysK) {
+		if (sysCode==SYS_LT) {
+			//Every repair packet stands on its own; no need to have them all around at once.
+			for (int i=0; i<sysN-sysK; i++) {
+				PktBuf *p=pktbufAlloc(PKTBUF_HEADROOM, maxPacketLen);
+				lt_encode(&lt, sysK+i, dataPtr, pktbufPut(p, maxPacketLen), maxPacketLen);
+				serial=sendFn(p);
+			}
+		} else {
+			for (int i=0; i<sysN-sysK; i++) {
+				parBuf[i]=pktbufAlloc(PKTBUF_HEADROOM, maxPacketLen);
+				parData[i]=pktbufPut(parBuf[i], maxPacketLen);
+			}
+			if (sysCode==SYS_CRS) {
+				crs_encode(&crs, dataPtr, parData, maxPacketLen);
+			} else {
+				gbf_encode_sys((gbf_int_t**)parData, sysN-sysK, (gbf_int_t**)dataPtr, sysK, (maxPacketLen/sizeof(gbf_int_t)));
+			}
+			for (int i=0; i<sysN-sysK; i++) serial=sendFn(parBuf[i]);
+		}
+		packetsStored=0;
+	}
+	return 1;
+}
+
+static void rsSysDeinit() {
+	free(packets); free(dataPtr); free(parBuf); free(parData);
+	packets=NULL; dataPtr=NULL; parBuf=NULL; parData=NULL;
+	if (sysCode==SYS_CRS) crs_free(&crs);
+	if (sysCode==SYS_LT) lt_free(&lt);
+}
+
+FecGenerator fecGenRsSys={
+	.name="rssys",
+	.desc="Systematic Reed-Solomon: data packets are sent as-is, followed by n-k Cauchy parity packets. N is at most 1024.",
+	.genId=FEC_ID_RS_SYS,
+	.init=rsSysInit,
+	.send=rsSysSend,
+	.deinit=rsSysDeinit,
+};
+
+FecGenerator fecGenCrs={
+	.name="crs",
+	.desc="Systematic Cauchy Reed-Solomon over GF(2^8) as XORs; cheap to decode on the badge. N is at most 256.",
+	.genId=FEC_ID_CRS,
+	.align=CRS_ALIGN,
+	.init=crsInit,
+	.send=rsSysSend,
+	.deinit=rsSysDeinit,
+};
+
+FecGenerator fecGenLt={
+	.name="lt",
+	.desc="LT fountain code: data packets as-is, then n-k XOR repair packets; any k plus a few decode. K is at most 256, n at most 1024.",
+	.genId=FEC_ID_LT,
+	.init=ltInit,
+	.send=rsSysSend,
+	.deinit=rsSysDeinit,
+};
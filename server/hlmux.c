@@ -2,33 +2,406 @@
 HLDemux
 Allows registration of sub-protocols and forwards a packet to the handlers for these protocols
 
+Packets come in on streams (one per producer connection) and are queued per stream. hlmuxPoll()
+moves whatever may go out to serdes.
+
+Which packet goes next is decided per traffic class; there is one class per HL packet type.
+Classes with a lower prio value are served strictly first. Classes with the same prio share
+the output by weight, using deficit round robin. A class can also have a byte budget per
+cycle; when it has used that up, it waits for the next cycle. Within a class, the stream that
+was served longest ago goes first. Optionally the total output rate is limited, so classes
+actually compete for a fixed air rate instead of everything going out as fast as it comes in.
+
+A packet can ask for a quiet period after it: e.g. receivers need time to write a block to
+flash before they can take the next one. The stream is then held, starting when the tail of
+that packet reaches the sender (past serdes, FEC stripes and signing), until the quiet period
+is over. Only that stream is held; other streams keep filling the air in the meantime. To know
+when that is, every packet sent down gets a sequence number, which the buffers below carry
+along as tailSeq; hlmuxOnAir() is told which ones made it to the bottom.
+
+A class can have a latency budget. Its packets get a deadline, which travels down with them:
+serdes and FEC don't sit on a half-full buffer or stripe with such a packet in it past that
+time, but pad it out and send it. That costs air time, so the time from queueing a packet until
+its tail reaches the sender is kept per class, to weigh against the padding the lower layers
+report.
+
+Large packets of a class can also be aligned: they start on a fresh serdes buffer and FEC
+stripe, and whatever is left of their last stripe is padded out. A lost stripe then only takes
+out the packet(s) in it, at the cost of the padding.
 */
+#define _POSIX_C_SOURCE 199309L
 #include <stdint.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <time.h>
 #include <arpa/inet.h>
 #include "sendif.h"
 #include "structs.h"
+#include "serdes.h"
+#include "hlmux.h"
 
+struct HlmuxStream {
+	PktBuf *qHead, *qTail;
+	HlmuxSentCb *sentCb;
+	void *sentArg;
+	int holdMsPending;		//quiet time to start once the tail is on the air
+	int tailPending;		//waiting for the tail of a held packet to reach the sender
+	uint64_t holdUntil;		//ms, monotonic clock
+	int closing;
+	uint32_t lastServed;	//scheduler sequence number of the last packet sent
+	HlmuxStream *next;
+	HlmuxStream *prev;
+};
 
 static SendCb *sendCb;
 static int sendMaxPktLen;
+static HlmuxStream *streams;
+static HlmuxStream *defaultStream;
+static uint32_t serveSeq;
+static uint32_t pktSeq;		//tailSeq of the last packet sent down
+
+//Packets sent down that we're waiting to see on the air, oldest first.
+typedef struct {
+	uint32_t seq;
+	int cls;
+	uint64_t queuedMs;
+	HlmuxStream *holdStream;	//stream to start the quiet period for, if any
+} AirWait;
+static AirWait *airWait;
+static int airWaitFirst, airWaitCount, airWaitSize;
+
+typedef struct {
+	int weight;
+	int prio;
+	int budget;				//bytes per cycle, 0 is unlimited
+	int deficit;
+	int cycleBytes;
+	uint64_t totalBytes;
+	int latencyMs;			//budget from queueing to on the air, 0 for none
+	int alignMinLen;		//align packets of at least this many bytes, 0 for none
+	//Time from queueing to on the air, this cycle
+	int latPackets;
+	uint64_t latTotalMs;
+	int latMaxMs;
+	//Scratch, valid during one scheduling step
+	HlmuxStream *cand;		//least recently served ready stream in this class
+} HlmuxClass;
+
+static HlmuxClass classes[HLMUX_NO_CLASSES];
+static int drrCur; //class DRR is currently serving
+
+#define DRR_QUANTUM 1024 //bytes per round per weight unit
+
+//Output rate limit (token bucket). 0 is unlimited.
+static int rateBps;
+static int64_t tokens;
+static uint64_t tokensUpdated;
+#define RATE_BURST_MS 50
+
+static uint64_t nowMs() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec*1000+ts.tv_nsec/1000000;
+}
 
 void hlmuxInit(SendCb *cb, int maxlen) {
 	sendCb=cb;
 	sendMaxPktLen=maxlen;
+	defaultStream=hlmuxStreamNew(NULL, NULL);
+	for (int i=0; i<HLMUX_NO_CLASSES; i++) {
+		classes[i].weight=1;
+		classes[i].prio=1;
+	}
+	//Housekeeping and subtitles are small and should not wait behind a block transfer.
+	classes[HLPACKET_TYPE_HK].prio=0;
+	classes[HLPACKET_TYPE_SUBTITLES].prio=0;
+	//...and shouldn't wait for a buffer to fill up either. Subtitles have to keep up with the
+	//music; housekeeping is less picky.
+	classes[HLPACKET_TYPE_HK].latencyMs=500;
+	classes[HLPACKET_TYPE_SUBTITLES].latencyMs=100;
+}
+
+static int classOf(PktBuf *p) {
+	int type=ntohs(((HlPacket*)p->data)->type);
+	return (type<HLMUX_NO_CLASSES)?type:HLMUX_NO_CLASSES-1;
+}
+
+int hlmuxSetClass(int type, int weight, int prio, int cycleBudget) {
+	if (type<0 || type>=HLMUX_NO_CLASSES || weight<1 || weight>1000 || prio<0 || cycleBudget<0) return 0;
+	classes[type].weight=weight;
+	classes[type].prio=prio;
+	classes[type].budget=cycleBudget;
+	return 1;
+}
+
+int hlmuxSetLatency(int type, int ms) {
+	if (type<0 || type>=HLMUX_NO_CLASSES || ms<0) return 0;
+	classes[type].latencyMs=ms;
+	return 1;
+}
+
+int hlmuxSetAlign(int type, int minLen) {
+	if (type<0 || type>=HLMUX_NO_CLASSES || minLen<0) return 0;
+	classes[type].alignMinLen=minLen;
+	return 1;
+}
+
+void hlmuxSetRate(int bytesPerSec) {
+	rateBps=bytesPerSec;
+	tokens=0;
+	tokensUpdated=nowMs();
+}
+
+void hlmuxNewCycle() {
+	for (int i=0; i<HLMUX_NO_CLASSES; i++) {
+		classes[i].cycleBytes=0;
+		classes[i].latPackets=0;
+		classes[i].latTotalMs=0;
+		classes[i].latMaxMs=0;
+	}
+}
+
+int hlmuxGetShares(char *buf, int len) {
+	uint64_t total=0;
+	int pos=0;
+	buf[0]=0;
+	for (int i=0; i<HLMUX_NO_CLASSES; i++) total+=classes[i].totalBytes;
+	for (int i=0; i<HLMUX_NO_CLASSES && pos<len-1; i++) {
+		if (classes[i].totalBytes==0) continue;
+		pos+=snprintf(buf+pos, len-pos, "%s%d:%llu:%.1f%%", pos?" ":"", i,
+				(unsigned long long)classes[i].totalBytes, classes[i].totalBytes*100.0/total);
+		//snprintf returns what it would have printed; don't run past a truncated buffer.
+		if (pos>=len) pos=len-1;
+	}
+	return pos;
+}
+
+int hlmuxGetLatency(char *buf, int len) {
+	int pos=0;
+	buf[0]=0;
+	for (int i=0; i<HLMUX_NO_CLASSES && pos<len-1; i++) {
+		HlmuxClass *c=&classes[i];
+		if (c->latPackets==0) continue;
+		pos+=snprintf(buf+pos, len-pos, "%s%d:%d:%d:%d", pos?" ":"", i,
+				(int)(c->latTotalMs/c->latPackets), c->latMaxMs, c->latencyMs);
+		if (pos>=len) pos=len-1;
+	}
+	return pos;
+}
+
+static void streamUnlink(HlmuxStream *s) {
+	if (s->prev) s->prev->next=s->next; else streams=s->next;
+	if (s->next) s->next->prev=s->prev;
+}
+
+static void tailSent(HlmuxStream *s) {
+	s->tailPending=0;
+	if (s->closing) {
+		free(s);
+		return;
+	}
+	s->holdUntil=nowMs()+s->holdMsPending;
+	s->holdMsPending=0;
+}
+
+HlmuxStream *hlmuxStreamNew(HlmuxSentCb *cb, void *arg) {
+	HlmuxStream *s=calloc(1, sizeof(HlmuxStream));
+	if (s==NULL) {
+		perror("hlmux: calloc");
+		exit(1);
+	}
+	s->sentCb=cb;
+	s->sentArg=arg;
+	s->next=streams;
+	if (streams) streams->prev=s;
+	streams=s;
+	return s;
+}
+
+void hlmuxStreamFree(HlmuxStream *s) {
+	while (s->qHead) {
+		PktBuf *p=s->qHead;
+		s->qHead=p->next;
+		pktbufFree(p);
+	}
+	s->qTail=NULL;
+	streamUnlink(s);
+	//The air wait list may still point at it; free when that comes by.
+	if (s->tailPending) {
+		s->closing=1;
+	} else {
+		free(s);
+	}
+}
+
+int hlmuxStreamSend(HlmuxStream *s, int type, int subtype, uint8_t *packet, size_t len, int holdMs) {
+	if (len>sendMaxPktLen-sizeof(HlPacket)) {
+		printf("hlmux: dropping packet of %d bytes, too big\n", (int)len);
+		return 0;
+	}
+	PktBuf *p=pktbufAlloc(sizeof(HlPacket), sendMaxPktLen-sizeof(HlPacket));
+	memcpy(pktbufPut(p, len), packet, len);
+	HlPacket *h=(HlPacket*)pktbufPush(p, sizeof(HlPacket));
+	h->type=htons(type);
+	h->subtype=htons(subtype);
+	p->holdMs=holdMs;
+	p->queuedMs=nowMs();
+	HlmuxClass *c=&classes[classOf(p)];
+	p->deadline=c->latencyMs?p->queuedMs+c->latencyMs:0;
+	if (c->alignMinLen && len>=c->alignMinLen) p->align=PKTBUF_ALIGN_START|PKTBUF_ALIGN_END;
+	//Block changes can be told apart in stripe descriptors; everything else is just 'any'.
+	if (subtype==BDSYNC_SUBTYPE_CHANGE && len>=sizeof(BDPacketChange)) {
+		p->content.type=type;
+		p->content.secFirst=p->content.secLast=ntohs(((BDPacketChange*)packet)->sector);
+	} else {
+		p->content.type=PKTBUF_CONTENT_ANY;
+	}
+	p->next=NULL;
+	if (s->qTail) s->qTail->next=p; else s->qHead=p;
+	s->qTail=p;
+	return 1;
+}
+
+static int streamReady(HlmuxStream *s, uint64_t now) {
+	return s->qHead && !s->tailPending && s->holdUntil<=now;
+}
+
+static int classEligible(HlmuxClass *c) {
+	return c->cand && (c->budget==0 || c->cycleBytes<c->budget);
+}
+
+//Find the ready stream for every class. Returns the best prio with something eligible, or -1.
+static int findCandidates(uint64_t now) {
+	for (int i=0; i<HLMUX_NO_CLASSES; i++) classes[i].cand=NULL;
+	for (HlmuxStream *s=streams; s!=NULL; s=s->next) {
+		if (!streamReady(s, now)) continue;
+		HlmuxClass *c=&classes[classOf(s->qHead)];
+		//Wrap-safe 'served longer ago than'
+		if (c->cand==NULL || (int32_t)(s->lastServed-c->cand->lastServed)<0) c->cand=s;
+	}
+	int best=-1;
+	for (int i=0; i<HLMUX_NO_CLASSES; i++) {
+		if (!classEligible(&classes[i])) continue;
+		if (best<0 || classes[i].prio<best) best=classes[i].prio;
+	}
+	return best;
+}
+
+//Deficit round robin over the eligible classes with the given prio. Returns the class to send from.
+static int drrPick(int prio) {
+	while (1) {
+		HlmuxClass *c=&classes[drrCur];
+		if (classEligible(c) && c->prio==prio) {
+			if (c->deficit>=(int)c->cand->qHead->len) return drrCur;
+		} else if (!c->cand) {
+			//Idle classes don't save up credit.
+			c->deficit=0;
+		}
+		drrCur=(drrCur+1)%HLMUX_NO_CLASSES;
+		c=&classes[drrCur];
+		if (classEligible(c) && c->prio==prio) c->deficit+=c->weight*DRR_QUANTUM;
+	}
+}
+
+static void airWaitAdd(PktBuf *p, HlmuxStream *holdStream) {
+	if (airWaitCount==airWaitSize) {
+		int newSize=airWaitSize?airWaitSize*2:64;
+		AirWait *n=malloc(sizeof(AirWait)*newSize);
+		if (n==NULL) {
+			perror("hlmux: malloc");
+			exit(1);
+		}
+		for (int i=0; i<airWaitCount; i++) n[i]=airWait[(airWaitFirst+i)%airWaitSize];
+		free(airWait);
+		airWait=n;
+		airWaitSize=newSize;
+		airWaitFirst=0;
+	}
+	AirWait *w=&airWait[(airWaitFirst+airWaitCount)%airWaitSize];
+	w->seq=p->tailSeq;
+	w->cls=classOf(p);
+	w->queuedMs=p->queuedMs;
+	w->holdStream=holdStream;
+	airWaitCount++;
+}
+
+void hlmuxOnAir(uint32_t seq) {
+	uint64_t now=nowMs();
+	//Wrap-safe 'seq is this one or newer'
+	while (airWaitCount && (int32_t)(seq-airWait[airWaitFirst].seq)>=0) {
+		AirWait *w=&airWait[airWaitFirst];
+		airWaitFirst=(airWaitFirst+1)%airWaitSize;
+		airWaitCount--;
+		HlmuxClass *c=&classes[w->cls];
+		int lat=now-w->queuedMs;
+		c->latPackets++;
+		c->latTotalMs+=lat;
+		if (lat>c->latMaxMs) c->latMaxMs=lat;
+		if (w->holdStream) tailSent(w->holdStream);
+	}
 }
 
+static void streamSendOne(HlmuxStream *s, uint64_t now) {
+	PktBuf *p=s->qHead;
+	s->qHead=p->next;
+	if (!s->qHead) s->qTail=NULL;
+	s->lastServed=++serveSeq;
+	p->tailSeq=++pktSeq;
+	if (pktSeq==0) p->tailSeq=++pktSeq; //0 is 'none'
+	if (p->holdMs) {
+		s->tailPending=1;
+		s->holdMsPending=p->holdMs;
+		//The stream can't go on until this is out, so don't let it sit in a half-full serdes
+		//buffer or FEC stripe: the deadline flush pads those out once nothing else can go in.
+		p->deadline=now;
+	}
+	airWaitAdd(p, p->holdMs?s:NULL);
+	sendCb(p);
+	if (s->sentCb) s->sentCb(s->sentArg);
+}
+
+static void refillTokens(uint64_t now) {
+	if (!rateBps) return;
+	tokens+=(int64_t)(now-tokensUpdated)*rateBps/1000;
+	tokensUpdated=now;
+	int64_t burst=(int64_t)rateBps*RATE_BURST_MS/1000;
+	if (tokens>burst) tokens=burst;
+}
+
+void hlmuxPoll() {
+	uint64_t now=nowMs();
+	refillTokens(now);
+	while (!rateBps || tokens>0) {
+		int prio=findCandidates(now);
+		if (prio<0) break;
+		HlmuxClass *c=&classes[drrPick(prio)];
+		int len=c->cand->qHead->len;
+		c->deficit-=len;
+		c->cycleBytes+=len;
+		c->totalBytes+=len;
+		tokens-=len;
+		streamSendOne(c->cand, now);
+	}
+}
+
+int hlmuxNextWakeupMs() {
+	uint64_t now=nowMs();
+	int64_t best=-1;
+	for (HlmuxStream *s=streams; s!=NULL; s=s->next) {
+		if (!s->qHead || s->tailPending) continue;
+		HlmuxClass *c=&classes[classOf(s->qHead)];
+		if (c->budget!=0 && c->cycleBytes>=c->budget) continue; //next cycle
+		int64_t t=(s->holdUntil>now)?(int64_t)(s->holdUntil-now):0;
+		if (best<0 || t<best) best=t;
+	}
+	//Waiting for the rate limiter?
+	if (best==0 && rateBps && tokens<=0) best=(-tokens*1000)/rateBps+1;
+	return best;
+}
 
 void hlmuxSend(int type, int subtype, uint8_t *packet, size_t len) {
-	int hlmuxMaxPacketLen=(sendMaxPktLen-sizeof(HlPacket)); //max data in a fec packet
-	HlPacket *p=malloc(sizeof(HlPacket)+hlmuxMaxPacketLen);
-	p->type=htons(type);
-	p->subtype=htons(subtype);
-	memcpy(p->data, packet, len);
-	sendCb((uint8_t*)p, len+sizeof(HlPacket));
-	free(p);
+	if (hlmuxStreamSend(defaultStream, type, subtype, packet, len, 0)) hlmuxPoll();
 }
 
 
@@ -3,9 +3,48 @@
 
 #include "sendif.h"
 
+typedef struct HlmuxStream HlmuxStream;
+
+//Called when a queued packet of the stream is passed on to the lower layers.
+typedef void (HlmuxSentCb)(void *arg);
+
+//One traffic class per HL packet type; higher types share the last class.
+#define HLMUX_NO_CLASSES 16
+
 void hlmuxInit(SendCb *cb, int maxlen);
+//Set scheduling for packets of a type. Lower prio is served strictly first; within the same
+//prio, classes share by weight. cycleBudget is in bytes, 0 for no limit. Returns 0 on bad args.
+int hlmuxSetClass(int type, int weight, int prio, int cycleBudget);
+//Packets of this type should be on the air within ms of being queued; 0 for no limit. Lower
+//layers pad out what they're collecting to get there. Returns 0 on bad args.
+int hlmuxSetLatency(int type, int ms);
+//Start packets of this type that are at least minLen bytes on a fresh FEC stripe, and pad their
+//last stripe; 0 turns this off. Returns 0 on bad args.
+int hlmuxSetAlign(int type, int minLen);
+//Limit the total output to this many bytes per second. 0 is unlimited.
+void hlmuxSetRate(int bytesPerSec);
+//Resets the per-cycle budgets and latency stats.
+void hlmuxNewCycle();
+//Print 'type:bytes:share' for every class that has sent something. Returns the length.
+int hlmuxGetShares(char *buf, int len);
+//Print 'type:avg:max:budget' (ms) for the time packets of every class took this cycle, from
+//being queued until their tail reached the sender. Returns the length.
+int hlmuxGetLatency(char *buf, int len);
+HlmuxStream *hlmuxStreamNew(HlmuxSentCb *cb, void *arg);
+//Drops anything still queued on the stream.
+void hlmuxStreamFree(HlmuxStream *s);
+//Queue a packet. holdMs is the quiet time receivers need on this stream after it. Returns 0
+//if the packet was dropped.
+int hlmuxStreamSend(HlmuxStream *s, int type, int subtype, uint8_t *packet, size_t len, int holdMs);
+//Send whatever may go out now.
+void hlmuxPoll();
+//Tell hlmux that the packets up to tailSeq (see PktBuf) have reached the sender.
+void hlmuxOnAir(uint32_t seq);
+//Ms until hlmuxPoll() may have something to do again, or -1 if that depends on new packets.
+int hlmuxNextWakeupMs();
+//Send a packet on the default stream, right away.
 void hlmuxSend(int type, int subtype, uint8_t *packet, size_t len);
 int hlmuxGetMaxPacketLength();
 
 
-#endif
\ No newline at end of file
+#endif
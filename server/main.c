@@ -8,49 +8,113 @@
 #include <sys/time.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
-#include <sys/select.h>
-#include "unistd.h"
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <time.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
 #include "sender.h"
 #include "fec.h"
 #include "sign.h"
 #include "serdes.h"
 #include "hlmux.h"
 #include "packetloss.h"
+#include "bppproto.h"
 
 
 typedef struct TcpClient TcpClient;
 
 #define MAX_LINE_LEN (8*1024*2)
+#define MAX_OUT_LEN 4096
 
 struct TcpClient {
 	int fd;
 	int type;
 	char buffer[MAX_LINE_LEN];
 	int pos;
+	char outbuf[MAX_OUT_LEN]; //responses that could not be written yet
+	int outlen;
+	int binary; //client negotiated binary packet frames
 	int waitingForNextCycle;
 	int delayAfterNextPacket;
+	HlmuxStream *stream;
+	int closing;
 	TcpClient *next;
+	TcpClient *prev;
+	TcpClient *nextClosing;
 };
 
 TcpClient *clients=NULL;
+static TcpClient *closingClients=NULL;
+
+static int epollFd, listenFd, udpFd, cycleTimerFd, tickTimerFd, schedTimerFd, signFd;
 
 int cycleLenMs=60000; //cycle defaults to 1 min
-struct timeval cycleStart;
+struct timespec cycleStart;
+
+//(Re)arm the cycle timer so it fires cycleLenMs after the start of the current cycle.
+static void armCycleTimer() {
+	struct itimerspec its;
+	memset(&its, 0, sizeof(its));
+	its.it_value.tv_sec=cycleStart.tv_sec+cycleLenMs/1000;
+	its.it_value.tv_nsec=cycleStart.tv_nsec+(cycleLenMs%1000)*1000000L;
+	if (its.it_value.tv_nsec>=1000000000L) {
+		its.it_value.tv_sec++;
+		its.it_value.tv_nsec-=1000000000L;
+	}
+	if (timerfd_settime(cycleTimerFd, TFD_TIMER_ABSTIME, &its, NULL)<0) {
+		perror("timerfd_settime");
+		exit(1);
+	}
+}
 
 void newCycle() {
-	printf("New cycle! Cycle len is %d ms\n", cycleLenMs);
-	gettimeofday(&cycleStart, NULL);
+	//The padding counters run forever; show what this cycle added, next to its queue-to-air times.
+	static uint64_t lastPadBytes, lastPadPackets;
+	uint64_t padBytes=serdesGetPadBytes(), padPackets=fecGetPadPackets();
+	char shares[400], latency[400];
+	hlmuxGetShares(shares, sizeof(shares));
+	hlmuxGetLatency(latency, sizeof(latency));
+	printf("New cycle! Cycle len is %d ms. Output per type: %s\n", cycleLenMs, shares);
+	printf("Queue-to-air ms per type (avg:max:budget): %s. Padding this cycle: %llu serdes bytes, %llu FEC packets\n",
+			latency, (unsigned long long)(padBytes-lastPadBytes), (unsigned long long)(padPackets-lastPadPackets));
+	lastPadBytes=padBytes;
+	lastPadPackets=padPackets;
+	hlmuxNewCycle();
+	clock_gettime(CLOCK_MONOTONIC, &cycleStart);
+	armCycleTimer();
 }
 
 int cycleRemainingMs() {
-	struct timeval now;
-	gettimeofday(&now, NULL);
-	int ms=(cycleStart.tv_sec-now.tv_sec)*1000+(cycleStart.tv_usec-now.tv_usec)/1000;
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	int ms=(cycleStart.tv_sec-now.tv_sec)*1000+(cycleStart.tv_nsec-now.tv_nsec)/1000000;
 	ms+=cycleLenMs;
 	return ms;
 }
 
 
+static void setNonBlocking(int fd) {
+	int fl=fcntl(fd, F_GETFL, 0);
+	if (fl<0 || fcntl(fd, F_SETFL, fl|O_NONBLOCK)<0) {
+		perror("fcntl");
+		exit(1);
+	}
+}
+
+static void addToEpoll(int fd, uint32_t events, void *ptr) {
+	struct epoll_event ev;
+	memset(&ev, 0, sizeof(ev));
+	ev.events=events;
+	ev.data.ptr=ptr;
+	if (epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &ev)<0) {
+		perror("epoll_ctl");
+		exit(1);
+	}
+}
+
 int createSocket(int port, int isUdp) {
 	int fd;
 	if (!isUdp) {
@@ -82,21 +146,81 @@ int createSocket(int port, int isUdp) {
 			exit(1);
 		}
 	}
+	setNonBlocking(fd);
 	return fd;
 }
 
 
+//Mark a client for removal. Actual freeing happens after the current batch of events is handled,
+//so no event in that batch can reference a freed client.
+static void closeClient(TcpClient *cl) {
+	if (cl->closing) return;
+	cl->closing=1;
+	cl->nextClosing=closingClients;
+	closingClients=cl;
+}
+
+static void reapClients() {
+	while (closingClients) {
+		TcpClient *cl=closingClients;
+		closingClients=cl->nextClosing;
+		printf("Client closed socket; cleaning up.\n");
+		close(cl->fd); //also removes it from the epoll set
+		hlmuxStreamFree(cl->stream);
+		if (cl->prev) cl->prev->next=cl->next; else clients=cl->next;
+		if (cl->next) cl->next->prev=cl->prev;
+		free(cl);
+	}
+}
+
+//Write as much of the pending output as the socket takes. The rest is sent on EPOLLOUT.
+static void flushClient(TcpClient *cl) {
+	int done=0;
+	while (done<cl->outlen) {
+		int r=write(cl->fd, &cl->outbuf[done], cl->outlen-done);
+		if (r<0 && errno==EINTR) continue;
+		if (r<0 && (errno==EAGAIN || errno==EWOULDBLOCK)) break;
+		if (r<=0) {
+			closeClient(cl);
+			cl->outlen=0;
+			return;
+		}
+		done+=r;
+	}
+	memmove(cl->outbuf, &cl->outbuf[done], cl->outlen-done);
+	cl->outlen-=done;
+}
+
+static void queueResp(TcpClient *cl, const char *buf, int len) {
+	if (cl->closing) return;
+	if (cl->outlen+len>MAX_OUT_LEN) {
+		//Client doesn't read its responses. Don't let it hold us up.
+		printf("Client doesn't read responses; dropping it.\n");
+		closeClient(cl);
+		return;
+	}
+	memcpy(&cl->outbuf[cl->outlen], buf, len);
+	cl->outlen+=len;
+	flushClient(cl);
+}
+
 static void sendResp(TcpClient *cl, int isAck) {
 	char buf[2];
 	buf[0]=isAck?'+':'-';
 	buf[1]='\n';
-	write(cl->fd, buf, 2);
+	queueResp(cl, buf, 2);
 }
 
 static void sendRespNum(TcpClient *cl, int isAck, int num) {
 	char buf[30];
 	sprintf(buf, "%s %d\n", isAck?"+":"-", num);
-	write(cl->fd, buf, strlen(buf));
+	queueResp(cl, buf, strlen(buf));
+}
+
+static void sendRespStr(TcpClient *cl, int isAck, const char *str) {
+	char buf[512];
+	snprintf(buf, sizeof(buf), "%s %s\n", isAck?"+":"-", str);
+	queueResp(cl, buf, strlen(buf));
 }
 
 
@@ -107,9 +231,23 @@ static int hexbin(char c) {
 	return -1;
 }
 
+//The packet of a client left the hlmux queue; ack it so the client sends the next one.
+static void packetSent(void *arg) {
+	sendResp((TcpClient*)arg, 1);
+}
+
+static void handlePacket(TcpClient *cl, int type, int subtype, uint8_t *data, int len) {
+	printf("Type %d subtype %d, %d bytes\n", type, subtype, len);
+	if (!hlmuxStreamSend(cl->stream, type, subtype, data, len, cl->delayAfterNextPacket)) {
+		sendResp(cl, 0);
+	}
+	cl->delayAfterNextPacket=0;
+}
+
 static void parseLine(char *buff, TcpClient *cl) {
 	if (strlen(buff)==0) return;
-	printf("Got from client: %s\n", buff);
+	//Don't dump hex packet payloads to the console; handlePacket logs those.
+	if (buff[0]!='p') printf("Got from client: %s\n", buff);
 	if (buff[0]=='t') { //set type
 		int type=strtol(buff+2, NULL, 16);
 		cl->type=type;
@@ -133,12 +271,9 @@ static void parseLine(char *buff, TcpClient *cl) {
 				n++;
 			}
 		}
-		printf("Subtype %d, %d bytes\n", subtype, p/2);
-		if (cl->delayAfterNextPacket) {
-			serdesWaitAfterSendingNext(cl->delayAfterNextPacket);
-			cl->delayAfterNextPacket=0;
-		}
-		hlmuxSend(cl->type, subtype, buff, p/2);
+		handlePacket(cl, cl->type, subtype, (uint8_t*)buff, p/2);
+	} else if (buff[0]=='b') { //switch to binary frames for packets
+		cl->binary=1;
 		sendResp(cl, 1);
 	} else if (buff[0]=='w') {//wait for next cycle
 		cl->waitingForNextCycle=1;
@@ -153,6 +288,7 @@ static void parseLine(char *buff, TcpClient *cl) {
 			sendResp(cl, 0);
 		} else {
 			cycleLenMs=i;
+			armCycleTimer();
 			sendResp(cl, 1);
 		}
 	} else if (buff[0]=='W') { //Set delay after next packet
@@ -163,144 +299,363 @@ static void parseLine(char *buff, TcpClient *cl) {
 			cl->delayAfterNextPacket=i;
 			sendResp(cl, 1);
 		}
+	} else if (buff[0]=='q') { //Set queueing for a packet type: q <type> <weight> <prio> <bytes per cycle>
+		int type, weight, prio, budget;
+		if (sscanf(&buff[1], "%d %d %d %d", &type, &weight, &prio, &budget)==4) {
+			sendResp(cl, hlmuxSetClass(type, weight, prio, budget));
+		} else {
+			sendResp(cl, 0);
+		}
+	} else if (buff[0]=='l') { //Set latency budget for a packet type: l <type> <ms>. 0 is none.
+		int type, ms;
+		if (sscanf(&buff[1], "%d %d", &type, &ms)==2) {
+			sendResp(cl, hlmuxSetLatency(type, ms));
+		} else {
+			sendResp(cl, 0);
+		}
+	} else if (buff[0]=='a') { //Align packets of a type to FEC stripes: a <type> <min len>. 0 is off.
+		int type, minLen;
+		if (sscanf(&buff[1], "%d %d", &type, &minLen)==2) {
+			sendResp(cl, hlmuxSetAlign(type, minLen));
+		} else {
+			sendResp(cl, 0);
+		}
+	} else if (buff[0]=='L') { //Get queue-to-air time per packet type this cycle
+		char buf[400];
+		hlmuxGetLatency(buf, sizeof(buf));
+		sendRespStr(cl, 1, buf);
+	} else if (buff[0]=='r') { //Set output rate limit, in bytes/sec. 0 is unlimited.
+		int i=strtol(&buff[1], NULL, 0);
+		if (i<0) {
+			sendResp(cl, 0);
+		} else {
+			hlmuxSetRate(i);
+			sendResp(cl, 1);
+		}
+	} else if (buff[0]=='s') { //Get bytes sent and share of output per packet type
+		char buf[400];
+		hlmuxGetShares(buf, sizeof(buf));
+		sendRespStr(cl, 1, buf);
 	} else {
 		sendResp(cl, 0);
 	}
 }
 
 
+static void parseFrame(BppFrameHdr *h, TcpClient *cl) {
+	//Flags are reserved for now; refuse what we don't understand.
+	if (h->flags!=0) {
+		sendResp(cl, 0);
+		return;
+	}
+	handlePacket(cl, ntohs(h->type), ntohs(h->subtype), (uint8_t*)(h+1), ntohl(h->len));
+}
+
 static void handleClient(TcpClient *cl) {
-	int foundEnter=0;
-	do {
-		int i;
-//		printf("Buf sz %d\n", cl->pos);
-		foundEnter=0;
-		for (i=0; i<cl->pos; i++) {
-			if (cl->buffer[i]=='\r' || cl->buffer[i]=='\n') {
-				foundEnter=1;
-				break;
+	int done=0;
+	while (done<cl->pos && !cl->closing) {
+		char *b=&cl->buffer[done];
+		int avail=cl->pos-done;
+		if (cl->binary && (uint8_t)b[0]==BPP_FRAME_MAGIC) {
+			//Binary frame. Wait until we have all of it.
+			if (avail<sizeof(BppFrameHdr)) break;
+			BppFrameHdr *h=(BppFrameHdr*)b;
+			uint32_t plen=ntohl(h->len);
+			if (plen>MAX_LINE_LEN-sizeof(BppFrameHdr)) {
+				printf("Client sent frame of %u bytes; too big.\n", plen);
+				closeClient(cl);
+				return;
 			}
+			if (avail<sizeof(BppFrameHdr)+plen) break;
+			parseFrame(h, cl);
+			done+=sizeof(BppFrameHdr)+plen;
+		} else {
+			int i;
+			for (i=0; i<avail; i++) {
+				if (b[i]=='\r' || b[i]=='\n') break;
+			}
+			if (i==avail) break;
+			b[i]=0;	//Zero-terminate string and get rid of newline
+			parseLine(b, cl);
+			done+=i+1;
+		}
+	}
+	memmove(cl->buffer, &cl->buffer[done], cl->pos-done);
+	cl->pos-=done;
+}
+
+static void acceptClients() {
+	while (1) {
+		int fd=accept(listenFd, NULL, NULL);
+		if (fd<0) {
+			if (errno!=EAGAIN && errno!=EWOULDBLOCK && errno!=EINTR) perror("accept");
+			if (errno==EINTR) continue;
+			return;
+		}
+		setNonBlocking(fd);
+		//New client. Allocate struct and link it in.
+		TcpClient *newc=malloc(sizeof(TcpClient));
+		memset(newc, 0, sizeof(TcpClient));
+		newc->fd=fd;
+		newc->type=-1;
+		newc->waitingForNextCycle=0;
+		newc->stream=hlmuxStreamNew(packetSent, newc);
+		newc->next=clients;
+		if (clients) clients->prev=newc;
+		clients=newc;
+		addToEpoll(fd, EPOLLIN|EPOLLOUT|EPOLLRDHUP|EPOLLET, newc);
+		printf("Accepted client\n");
+	}
+}
+
+static void readUdp() {
+	while (1) {
+		char buf[16];
+		struct sockaddr_storage src;
+		socklen_t srclen=sizeof(src);
+		int l=recvfrom(udpFd, buf, sizeof(buf), 0, (struct sockaddr*)&src, &srclen);
+		if (l<0) {
+			if (errno==EINTR) continue;
+			return;
+		}
+		if (l>0 && buf[0]=='C') {
+			senderAddDestSockaddr((struct sockaddr*)&src, srclen, 10*60);
+		}
+	}
+}
+
+static void readClient(TcpClient *cl) {
+	//Edge-triggered: keep reading until the socket is drained.
+	while (!cl->closing) {
+		int l=MAX_LINE_LEN-cl->pos;
+		if (l==0) {
+			//Reached max line size. Only allow one enter to be read.
+			cl->pos-=1;
+			l=1;
+		}
+		int r=read(cl->fd, &cl->buffer[cl->pos], l);
+		if (r<0 && errno==EINTR) continue;
+		if (r<0 && (errno==EAGAIN || errno==EWOULDBLOCK)) return;
+		if (r<1) {
+			//Error or EOF. Close socket, unlink client struct.
+			closeClient(cl);
+			return;
 		}
-		if (foundEnter) {
-			cl->buffer[i]=0;	//Zero-terminate string and get rid of newline
-			parseLine(cl->buffer, cl);
-			memmove(cl->buffer, &cl->buffer[i+1], MAX_LINE_LEN-(i+1));
-			cl->pos-=i+1;
+		cl->pos+=r;
+		handleClient(cl);
+	}
+}
+
+static void handleCycleTimer() {
+	uint64_t expirations;
+	if (read(cycleTimerFd, &expirations, sizeof(expirations))<0) return;
+	//Timer may have been re-armed to a later time by a 'C' command in the meantime.
+	if (cycleRemainingMs()>0) return;
+	//Warn all clients waiting for next cycle
+	for (TcpClient *i=clients; i!=NULL; i=i->next) {
+		if (i->waitingForNextCycle) {
+			sendResp(i, 1);
+			i->waitingForNextCycle=0;
 		}
-	} while (foundEnter);
+	}
+	//Start next cycle
+	newCycle();
+}
+
+static void handleTickTimer() {
+	uint64_t expirations;
+	if (read(tickTimerFd, &expirations, sizeof(expirations))<0) return;
+	while (expirations--) senderTick();
+}
+
+static uint64_t nowMs() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec*1000+ts.tv_nsec/1000000;
+}
+
+//Ms until a deadline, -1 if there is none.
+static int msUntil(uint64_t deadline, uint64_t now) {
+	if (!deadline) return -1;
+	return (deadline>now)?deadline-now:0;
+}
+
+//Bottom of the send stack. What gets here is on the air as far as hlmux is concerned, so tell
+//it which of its packets made it.
+static SendCb *airSendCb;
+static void sendToAir(PktBuf *p) {
+	uint32_t seq=p->tailSeq;
+	airSendCb(p);
+	if (seq) hlmuxOnAir(seq);
+}
+
+//Data with a latency budget shouldn't sit in a half-full serdes buffer, FEC stripe or hash list
+//past its deadline. Go top down: flushing one layer may pass data with a deadline to the next.
+static void flushExpired() {
+	uint64_t now=nowMs();
+	if (msUntil(serdesGetDeadline(), now)==0) serdesFlush();
+	if (msUntil(fecGetDeadline(), now)==0) fecFlush();
+	if (msUntil(signGetDeadline(), now)==0) signFlush();
+}
+
+//Make sure the loop wakes up when a held hlmux stream may send again, or a deadline expires.
+static void armSchedTimer() {
+	struct itimerspec its;
+	memset(&its, 0, sizeof(its));
+	uint64_t now=nowMs();
+	int ms=hlmuxNextWakeupMs();
+	int dl[]={msUntil(serdesGetDeadline(), now), msUntil(fecGetDeadline(), now), msUntil(signGetDeadline(), now)};
+	for (int i=0; i<3; i++) {
+		if (dl[i]>=0 && (ms<0 || dl[i]<ms)) ms=dl[i];
+	}
+	if (ms==0) ms=1;
+	if (ms>0) {
+		its.it_value.tv_sec=ms/1000;
+		its.it_value.tv_nsec=(ms%1000)*1000000L;
+	}
+	if (timerfd_settime(schedTimerFd, 0, &its, NULL)<0) {
+		perror("timerfd_settime");
+		exit(1);
+	}
 }
 
 //#define SIMULATE_PACKET_LOSS
 
+#define MAX_EVENTS 64
 
 int main(int argc, char **argv) {
-	int listenFd, udpFd;
+	int signThreads=0;
+	int hashChainLen=0;
+	char fecName[32]="";
+	int fecK=4, fecN=8, fecDepth=1;
+	int stripeDesc=0;
+	int opt;
+	while ((opt=getopt(argc, argv, "t:H:f:d"))!=-1) {
+		if (opt=='t') {
+			signThreads=atoi(optarg);
+		} else if (opt=='H') {
+			hashChainLen=atoi(optarg);
+		} else if (opt=='f') {
+			sscanf(optarg, "%31[^:]:%d:%d:%d", fecName, &fecK, &fecN, &fecDepth);
+		} else if (opt=='d') {
+			stripeDesc=1;
+		} else {
+			printf("Usage: %s [-t signing threads] [-H packets per signed hash list] [-f fec[:k:n[:interleave depth]]] [-d (send stripe descriptors)] [destination...]\n", argv[0]);
+			exit(1);
+		}
+	}
 	senderInit();
-	for (int i=1; i<argc; i++) {
+	for (int i=optind; i<argc; i++) {
 		senderAddDest(argv[i], 0);
 	}
 	
 #ifndef SIMULATE_PACKET_LOSS
-	signInit(senderSendPkt, senderGetMaxPacketLength());
+	airSendCb=senderSendPkt;
+	signInit(sendToAir, senderGetMaxPacketLength());
+	if (!signSetHashChain(hashChainLen)) {
+		printf("Can't do hash chains of %d packets\n", hashChainLen);
+		exit(1);
+	}
 #else
 	packetlossInit(senderSendPkt, senderGetMaxPacketLength());
-	signInit(packetlossSend, packetlossGetMaxPacketLength());
+	airSendCb=packetlossSend;
+	signInit(sendToAir, packetlossGetMaxPacketLength());
+	if (!signSetHashChain(hashChainLen)) {
+		printf("Can't do hash chains of %d packets\n", hashChainLen);
+		exit(1);
+	}
 #endif
 	fecInit(signSend, signGetMaxPacketLength());
+	fecSetStripeDesc(stripeDesc);
+	if (fecName[0] && !fecSetGenerator(fecName, fecK, fecN, fecDepth)) {
+		printf("Can't use FEC '%s' with k=%d n=%d interleaved %d deep. Available:\n", fecName, fecK, fecN, fecDepth);
+		fecListGenerators();
+		exit(1);
+	}
 	serdesInit(fecSend, fecGetMaxPacketLength());
 	hlmuxInit(serdesSend, serdesGetMaxPacketLength());
+	if (signThreads) printf("Signing on %d threads\n", signSetThreads(signThreads));
 
+	signal(SIGPIPE, SIG_IGN);
+
+	epollFd=epoll_create1(0);
+	if (epollFd<0) {
+		perror("epoll_create1");
+		exit(1);
+	}
+	cycleTimerFd=timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+	if (cycleTimerFd<0) {
+		perror("timerfd_create");
+		exit(1);
+	}
+	//Once-a-second tick for destination expiry
+	tickTimerFd=timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+	if (tickTimerFd<0) {
+		perror("timerfd_create");
+		exit(1);
+	}
+	struct itimerspec tick={.it_interval={.tv_sec=1}, .it_value={.tv_sec=1}};
+	if (timerfd_settime(tickTimerFd, 0, &tick, NULL)<0) {
+		perror("timerfd_settime");
+		exit(1);
+	}
+	schedTimerFd=timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+	if (schedTimerFd<0) {
+		perror("timerfd_create");
+		exit(1);
+	}
 	listenFd=createSocket(2017, 0);
 	udpFd=createSocket(2017, 1);
+	//The address of the static fd variable is used to recognize the non-client events.
+	addToEpoll(listenFd, EPOLLIN|EPOLLET, &listenFd);
+	addToEpoll(udpFd, EPOLLIN|EPOLLET, &udpFd);
+	addToEpoll(cycleTimerFd, EPOLLIN|EPOLLET, &cycleTimerFd);
+	addToEpoll(tickTimerFd, EPOLLIN|EPOLLET, &tickTimerFd);
+	addToEpoll(schedTimerFd, EPOLLIN|EPOLLET, &schedTimerFd);
+	signFd=signGetEventFd();
+	if (signFd>=0) addToEpoll(signFd, EPOLLIN|EPOLLET, &signFd);
 
 	newCycle();
 	while(1) {
-		int max;
-		fd_set rfds;
-		struct timeval tout;
-		FD_ZERO(&rfds);
-		FD_SET(listenFd, &rfds);
-		FD_SET(udpFd, &rfds);
-		max=listenFd;
-		if (max<udpFd) max=udpFd;
-		for (TcpClient *i=clients; i!=NULL; i=i->next) {
-			FD_SET(i->fd, &rfds);
-			if (max<i->fd) max=i->fd;
-		}
-		int ms=cycleRemainingMs();
-		if (ms<0) ms=0;
-		tout.tv_sec=ms/1000;
-		tout.tv_usec=(ms%1000)*1000;
-		int r=select(max+1, &rfds, NULL, NULL, &tout);
-		if (r==-1) {
-			perror("select");
+		struct epoll_event events[MAX_EVENTS];
+		int n=epoll_wait(epollFd, events, MAX_EVENTS, -1);
+		if (n==-1) {
+			if (errno==EINTR) continue;
+			perror("epoll_wait");
 			exit(1);
 		}
 
-		if (cycleRemainingMs()<=0) {
-			//Warn all clients waiting for next cycle
-			for (TcpClient *i=clients; i!=NULL; i=i->next) {
-				if (i->waitingForNextCycle) {
-					sendResp(i, 1);
-					i->waitingForNextCycle=0;
-				}
-			}
-			//Start next cycle
-			newCycle();
-			continue; //because select may not have run
-		}
-
-		if (FD_ISSET(listenFd, &rfds)) {
-			//New client. Allocate struct and accept.
-			TcpClient *newc=malloc(sizeof(TcpClient));
-			memset(newc, 0, sizeof(TcpClient));
-			newc->fd=accept(listenFd, NULL, NULL);
-			newc->type=-1;
-			newc->next=clients;
-			newc->waitingForNextCycle=0;
-			clients=newc;
-			printf("Accepted client\n");
-		}
-		if (FD_ISSET(udpFd, &rfds)) {
-			char buf[16];
-			struct sockaddr src;
-			int l;
-			socklen_t srclen;
-			l=recvfrom(udpFd, buf, sizeof(buf), 0, &src, &srclen);
-			if (l>0 && buf[0]=='C') {
-				senderAddDestSockaddr(&src, srclen, 10*60);
-			}
-		}
-
-		for (TcpClient *i=clients; i!=NULL; i=i->next) {
-			if (FD_ISSET(i->fd, &rfds)) {
-				int l=MAX_LINE_LEN-i->pos;
-				if (l==0) {
-					//Reached max line size. Only allow one enter to be read.
-					i->pos-=1;
-					l=1;
-				}
-				int r=read(i->fd, &i->buffer[i->pos], l);
-				if (r<1) {
-					//Error. Close socket, unlink client struct.
-					printf("Client closed socket; cleaning up.\n");
-					close(i->fd);
-					if (i==clients) {
-						clients=i->next;
-					} else {
-						//Look up struct linking to here
-						TcpClient *j;
-						for (j=clients; j->next!=i; j=j->next);
-						j->next=i->next;
-					}
-					free(i);
-					//Loop iterator is broken now. Bail out, select will trigger a new loop.
-					break;
-				} else {
-					i->pos+=r;
-					handleClient(i);
+		for (int i=0; i<n; i++) {
+			void *src=events[i].data.ptr;
+			if (src==&cycleTimerFd) {
+				handleCycleTimer();
+			} else if (src==&tickTimerFd) {
+				handleTickTimer();
+			} else if (src==&schedTimerFd) {
+				uint64_t expirations;
+				read(schedTimerFd, &expirations, sizeof(expirations));
+				//hlmuxPoll() below does the work
+			} else if (src==&signFd) {
+				signPoll();
+			} else if (src==&listenFd) {
+				acceptClients();
+			} else if (src==&udpFd) {
+				readUdp();
+			} else {
+				TcpClient *cl=(TcpClient*)src;
+				if (events[i].events&(EPOLLERR|EPOLLHUP)) {
+					closeClient(cl);
+					continue;
 				}
+				if (events[i].events&EPOLLOUT) flushClient(cl);
+				if (events[i].events&(EPOLLIN|EPOLLRDHUP)) readClient(cl);
 			}
 		}
+		reapClients();
+		hlmuxPoll();
+		flushExpired();
+		armSchedTimer();
+		//Send out whatever the events above produced in one go.
+		senderFlush();
 	}
 }
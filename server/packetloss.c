@@ -24,16 +24,19 @@ void packetlossInit(SendCb *cb, int maxlen) {
 }
 
 
-void packetlossSend(uint8_t *packet, size_t len) {
+void packetlossSend(PktBuf *packet) {
 	int i=rand()%1000;
 	int j=rand()%1000;
 
-	if (i<DROP_PML) return;
+	if (i<DROP_PML) {
+		pktbufFree(packet);
+		return;
+	}
 
 	if (j<MANGLE_PML) {
-		packet[rand()%len]=rand();
+		packet->data[rand()%packet->len]=rand();
 	}
-	sendCb(packet, len);
+	sendCb(packet);
 }
 
 
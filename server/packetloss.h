@@ -5,7 +5,7 @@
 
 
 void packetlossInit(SendCb *cb, int maxlen);
-void packetlossSend(uint8_t *packet, size_t len);
+void packetlossSend(PktBuf *packet);
 int packetlossGetMaxPacketLength();
 
 #endif
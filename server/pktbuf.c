@@ -0,0 +1,93 @@
+/*
+Packet buffers with headroom, allocated from per-size-class free lists.
+*/
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include "pktbuf.h"
+
+//Small class fits an on-air packet plus headroom, large one a full serdes input packet.
+static const int classSize[]={2048, 16384};
+#define NO_CLASSES (sizeof(classSize)/sizeof(classSize[0]))
+
+static PktBuf *freeList[NO_CLASSES];
+static PktBufStats stats;
+
+PktBuf *pktbufAlloc(int headroom, int maxLen) {
+	int c;
+	for (c=0; c<NO_CLASSES; c++) {
+		if (headroom+maxLen<=classSize[c]) break;
+	}
+	assert(c!=NO_CLASSES);
+	PktBuf *p=freeList[c];
+	if (p) {
+		freeList[c]=p->next;
+	} else {
+		p=malloc(sizeof(PktBuf)+classSize[c]);
+		if (p==NULL) {
+			perror("pktbufAlloc");
+			exit(1);
+		}
+		p->size=classSize[c];
+		p->sizeClass=c;
+		stats.mallocs++;
+	}
+	p->data=p->buf+headroom;
+	p->len=0;
+	p->next=NULL;
+	p->holdMs=0;
+	p->deadline=0;
+	p->tailSeq=0;
+	p->align=0;
+	p->content.type=PKTBUF_CONTENT_NONE;
+	p->signAlone=0;
+	stats.allocs++;
+	stats.inUse++;
+	return p;
+}
+
+void pktbufFree(PktBuf *p) {
+	if (p==NULL) return;
+	p->next=freeList[p->sizeClass];
+	freeList[p->sizeClass]=p;
+	stats.inUse--;
+}
+
+uint8_t *pktbufPush(PktBuf *p, int n) {
+	assert(p->data-n >= p->buf);
+	p->data-=n;
+	p->len+=n;
+	return p->data;
+}
+
+uint8_t *pktbufPull(PktBuf *p, int n) {
+	assert(n<=p->len);
+	p->data+=n;
+	p->len-=n;
+	return p->data;
+}
+
+uint8_t *pktbufPut(PktBuf *p, int n) {
+	uint8_t *r=p->data+p->len;
+	assert(r+n <= p->buf+p->size);
+	p->len+=n;
+	return r;
+}
+
+void pktbufGetStats(PktBufStats *st) {
+	memcpy(st, &stats, sizeof(stats));
+}
+
+void pktbufContentMerge(PktBufContent *into, const PktBufContent *c) {
+	if (c->type==PKTBUF_CONTENT_NONE) return;
+	if (into->type==PKTBUF_CONTENT_NONE) {
+		*into=*c;
+	} else if (into->type!=c->type || c->type==PKTBUF_CONTENT_ANY) {
+		into->type=PKTBUF_CONTENT_ANY;
+	} else {
+		if (c->secFirst<into->secFirst) into->secFirst=c->secFirst;
+		if (c->secLast>into->secLast) into->secLast=c->secLast;
+	}
+}
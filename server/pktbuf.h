@@ -0,0 +1,82 @@
+#ifndef PKTBUF_H
+#define PKTBUF_H
+
+/*
+Packet buffers.
+
+Every layer of the send stack adds a header in front of what it gets from the layer above.
+Instead of allocating a new buffer and copying the payload behind the new header, packets
+travel down the stack in a PktBuf. A PktBuf is allocated with enough room in front of the
+data (headroom) for all headers that still have to be prepended, so a layer can just push
+its header in place.
+
+Ownership of a PktBuf passes along with it: whoever gets handed one through a SendCb must
+either pass it on or pktbufFree() it.
+
+Buffers come from a few fixed size classes. Freed buffers go on a per-class free list and
+are re-used, so after warming up the send path does not call malloc anymore.
+*/
+
+#include <stdint.h>
+#include <stddef.h>
+
+//Headroom to reserve when allocating a buffer that still has to go through the lower
+//layers. Needs to fit the FecPacket and SignedPacket headers.
+#define PKTBUF_HEADROOM 128
+
+//Start the packet on a fresh serdes buffer and FEC stripe, and/or pad out what's left of those
+//after it.
+#define PKTBUF_ALIGN_START	1
+#define PKTBUF_ALIGN_END	2
+
+//What a buffer holds (bytes of), for stripe descriptors (see StripeDesc in structs.h).
+#define PKTBUF_CONTENT_NONE	-1	//nothing yet
+#define PKTBUF_CONTENT_ANY	-2	//mixed, or not only block changes
+typedef struct {
+	int type;			//HL type of the block changes in it, or PKTBUF_CONTENT_*
+	int secFirst, secLast;
+} PktBufContent;
+
+typedef struct PktBuf PktBuf;
+
+struct PktBuf {
+	uint8_t *data;		//start of packet
+	size_t len;			//length of packet
+	size_t size;		//total size of buf
+	PktBuf *next;		//free for use by the current owner (queues etc)
+	int holdMs;			//hlmux: receivers need this much quiet time on the stream after this packet
+	uint64_t queuedMs;	//hlmux: when the packet was queued
+	uint32_t tailSeq;	//hlmux numbers HL packets; all up to this one have their last byte in here or
+						//in an earlier buffer. 0 if none of them end here.
+	uint64_t deadline;	//ms (CLOCK_MONOTONIC) by which the contents should be on the air; 0 for none
+	int align;			//PKTBUF_ALIGN_* flags
+	PktBufContent content;
+	int signAlone;		//sign: give this one its own signature, even when hash chaining
+	int sizeClass;
+	uint8_t buf[];
+};
+
+typedef struct {
+	int allocs;			//pktbufAlloc calls
+	int mallocs;		//times the pool had to grow
+	int inUse;			//buffers currently handed out
+} PktBufStats;
+
+//Allocate a buffer with space for headroom+maxLen bytes. data points headroom bytes into the
+//buffer; len is 0.
+PktBuf *pktbufAlloc(int headroom, int maxLen);
+void pktbufFree(PktBuf *p);
+
+//Prepend n bytes to the packet, returns pointer to the new start.
+uint8_t *pktbufPush(PktBuf *p, int n);
+//Strip n bytes off the start of the packet, returns pointer to the new start.
+uint8_t *pktbufPull(PktBuf *p, int n);
+//Append n bytes to the end of the packet, returns pointer to the appended bytes.
+uint8_t *pktbufPut(PktBuf *p, int n);
+
+void pktbufGetStats(PktBufStats *st);
+
+//Add what c describes to what 'into' describes.
+void pktbufContentMerge(PktBufContent *into, const PktBufContent *c);
+
+#endif
@@ -1,31 +1,236 @@
+#define _GNU_SOURCE //for sendmmsg
 #include <errno.h>
 #include <string.h>
 #include <unistd.h>
 #include <netdb.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
+#include <netinet/udp.h>
 #include <sys/uio.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
+#include "sender.h"
 
-typedef struct SenderDstItem SenderDstItem;
+#ifndef SOL_UDP
+#define SOL_UDP 17
+#endif
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT 103
+#endif
 
-struct SenderDstItem{
-	struct sockaddr *addr;
+/*
+Destinations live in three structures at once:
+- a dense array, which is what the send path iterates over,
+- an open-addressing hash table keyed on the sockaddr, so re-registering (which every receiver
+  does every few minutes) is O(1),
+- a hierarchical timer wheel for expiry. The wheel advances once per senderTick() (one second)
+  instead of the send path sweeping all destinations.
+A timeout of 0 means the destination never expires (e.g. the ones given on the command line).
+*/
+
+typedef struct SenderDest SenderDest;
+
+struct SenderDest {
+	struct sockaddr_storage addr;
 	socklen_t addrlen;
-	time_t timeout;
-	SenderDstItem *next;
+	uint32_t expires;		//tick at which this dest expires
+	int listIdx;			//index in destList
+	int inWheel;
+	int dead;				//send failed; removed at the end of the flush
+	SenderDest *next;		//wheel slot / dead list links
+	SenderDest *prev;
 };
 
 static int senderFd;
-static SenderDstItem *senderDest;
+static int gsoEnabled;
+
+//Dense array of all destinations
+static SenderDest **destList;
+static int noDests, destListAlloced;
+
+//Hash table, linear probing. Size is a power of two, kept at most half full.
+static SenderDest **destHash;
+static int destHashSize;
+
+//Timer wheel: WHEEL_LEVELS levels of WHEEL_SLOTS slots each. Level L slot covers 64^L ticks.
+#define WHEEL_BITS 6
+#define WHEEL_SLOTS (1<<WHEEL_BITS)
+#define WHEEL_LEVELS 4
+#define WHEEL_MAX_TIMEOUT ((1<<(WHEEL_BITS*WHEEL_LEVELS))-1)
+static SenderDest *wheel[WHEEL_LEVELS][WHEEL_SLOTS];
+static uint32_t curTick;
+
+//Dests that failed to send during this flush
+static SenderDest *deadDests;
+
+static void *growArray(void *p, int *alloced, int needed, size_t elsize) {
+	if (needed<=*alloced) return p;
+	p=realloc(p, needed*elsize);
+	if (p==NULL) {
+		perror("sender: realloc");
+		exit(1);
+	}
+	*alloced=needed;
+	return p;
+}
+
+static uint32_t hashAddr(const struct sockaddr *addr, socklen_t addrlen) {
+	//FNV-1a
+	const uint8_t *p=(const uint8_t*)addr;
+	uint32_t h=2166136261u;
+	for (int i=0; i<addrlen; i++) {
+		h^=p[i];
+		h*=16777619u;
+	}
+	return h;
+}
+
+static int hashSlot(SenderDest *d) {
+	int mask=destHashSize-1;
+	int i=hashAddr((struct sockaddr*)&d->addr, d->addrlen)&mask;
+	while (destHash[i]!=d) i=(i+1)&mask;
+	return i;
+}
+
+static SenderDest *hashFind(const struct sockaddr *addr, socklen_t addrlen) {
+	if (destHashSize==0) return NULL;
+	int mask=destHashSize-1;
+	int i=hashAddr(addr, addrlen)&mask;
+	while (destHash[i]) {
+		SenderDest *d=destHash[i];
+		if (d->addrlen==addrlen && memcmp(&d->addr, addr, addrlen)==0) return d;
+		i=(i+1)&mask;
+	}
+	return NULL;
+}
+
+static void hashInsertNoGrow(SenderDest *d) {
+	int mask=destHashSize-1;
+	int i=hashAddr((struct sockaddr*)&d->addr, d->addrlen)&mask;
+	while (destHash[i]) i=(i+1)&mask;
+	destHash[i]=d;
+}
+
+static void hashInsert(SenderDest *d) {
+	if ((noDests+1)*2>destHashSize) {
+		//Grow and rehash
+		SenderDest **old=destHash;
+		int oldSize=destHashSize;
+		destHashSize=destHashSize?destHashSize*2:64;
+		destHash=calloc(destHashSize, sizeof(SenderDest*));
+		if (destHash==NULL) {
+			perror("sender: calloc");
+			exit(1);
+		}
+		for (int i=0; i<oldSize; i++) {
+			if (old[i]) hashInsertNoGrow(old[i]);
+		}
+		free(old);
+	}
+	hashInsertNoGrow(d);
+}
+
+static void hashRemove(SenderDest *d) {
+	//Backward-shift deletion, so no tombstones are needed.
+	int mask=destHashSize-1;
+	int i=hashSlot(d);
+	int j=i;
+	while (1) {
+		destHash[i]=NULL;
+		while (1) {
+			j=(j+1)&mask;
+			if (destHash[j]==NULL) return;
+			int home=hashAddr((struct sockaddr*)&destHash[j]->addr, destHash[j]->addrlen)&mask;
+			//Entry at j can move to i if its home slot is not cyclically in (i, j].
+			if (i<=j ? (home<=i || home>j) : (home<=i && home>j)) break;
+		}
+		destHash[i]=destHash[j];
+		i=j;
+	}
+}
+
+static void wheelLink(SenderDest **slot, SenderDest *d) {
+	d->prev=NULL;
+	d->next=*slot;
+	if (*slot) (*slot)->prev=d;
+	*slot=d;
+}
+
+static void wheelInsert(SenderDest *d) {
+	uint32_t delta=d->expires-curTick;
+	int level=0;
+	while (level<WHEEL_LEVELS-1 && delta>=(1u<<(WHEEL_BITS*(level+1)))) level++;
+	wheelLink(&wheel[level][(d->expires>>(WHEEL_BITS*level))&(WHEEL_SLOTS-1)], d);
+	d->inWheel=1;
+}
+
+static void wheelUnlink(SenderDest *d) {
+	if (d->prev) {
+		d->prev->next=d->next;
+	} else {
+		//First in its slot; find the slot it heads.
+		for (int l=0; l<WHEEL_LEVELS; l++) {
+			SenderDest **slot=&wheel[l][(d->expires>>(WHEEL_BITS*l))&(WHEEL_SLOTS-1)];
+			if (*slot==d) {
+				*slot=d->next;
+				break;
+			}
+		}
+	}
+	if (d->next) d->next->prev=d->prev;
+	d->next=d->prev=NULL;
+	d->inWheel=0;
+}
+
+//Send to this dest failed. It can't be removed while the batch is still being sent, so
+//park it on the dead list for now.
+static void destMarkDead(SenderDest *d) {
+	if (d->dead) return;
+	if (d->inWheel) wheelUnlink(d);
+	d->dead=1;
+	d->next=deadDests;
+	deadDests=d;
+}
+
+static void destRemove(SenderDest *d) {
+	hashRemove(d);
+	noDests--;
+	destList[d->listIdx]=destList[noDests];
+	destList[d->listIdx]->listIdx=d->listIdx;
+	free(d);
+}
+
+//Called once per second.
+void senderTick() {
+	curTick++;
+	//Cascade higher levels down when the level below wraps.
+	for (int l=1; l<WHEEL_LEVELS; l++) {
+		if ((curTick&((1u<<(WHEEL_BITS*l))-1))!=0) break;
+		SenderDest **slot=&wheel[l][(curTick>>(WHEEL_BITS*l))&(WHEEL_SLOTS-1)];
+		SenderDest *d=*slot;
+		*slot=NULL;
+		while (d) {
+			SenderDest *next=d->next;
+			wheelInsert(d);
+			d=next;
+		}
+	}
+	//Everything in the current level 0 slot expires now.
+	SenderDest **slot=&wheel[0][curTick&(WHEEL_SLOTS-1)];
+	SenderDest *d=*slot;
+	*slot=NULL;
+	while (d) {
+		SenderDest *next=d->next;
+		destRemove(d);
+		d=next;
+	}
+}
 
 
 int senderInit() {
-	senderDest=NULL;
 	senderFd=socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
 	if (!senderFd) {
 		perror("creating udp socket");
@@ -36,6 +241,11 @@ int senderInit() {
 		perror("setsockopt() failed");
 		return 0;
 	}
+	//See if the kernel knows about UDP GSO.
+	int segSize=0;
+	socklen_t segSizeLen=sizeof(segSize);
+	gsoEnabled=(getsockopt(senderFd, SOL_UDP, UDP_SEGMENT, &segSize, &segSizeLen)==0);
+	printf("sender: UDP GSO %s\n", gsoEnabled?"available":"not available");
 	return 1;
 }
 
@@ -43,25 +253,30 @@ int senderInit() {
 #define str2(a) #a
 
 int senderAddDestSockaddr(struct sockaddr *addr, socklen_t addrlen, int timeout) {
-	SenderDstItem *dest;
-	for (dest=senderDest; dest!=NULL; dest=dest->next) {
-		if (dest->addrlen==addrlen && memcmp(dest->addr, addr, addrlen)==0) break;
-	}
+	if (addrlen>sizeof(struct sockaddr_storage)) return 0;
+	if (timeout>WHEEL_MAX_TIMEOUT) timeout=WHEEL_MAX_TIMEOUT;
+	SenderDest *dest=hashFind(addr, addrlen);
 	if (dest!=NULL) {
 		//Just modify timeout.
-		dest->timeout=time(NULL)+timeout;
+		if (dest->dead) return 1;
+		if (dest->inWheel) wheelUnlink(dest);
 	} else {
-		//Allocate new dest struct, and everything in it
-		dest=malloc(sizeof(SenderDstItem));
-		memset(dest, 0, sizeof(SenderDstItem));
-		dest->addr=malloc(addrlen);
-		//Copy over info
-		memcpy(dest->addr, addr, addrlen);
+		//Allocate new dest struct
+		dest=calloc(1, sizeof(SenderDest));
+		if (dest==NULL) {
+			perror("sender: calloc");
+			exit(1);
+		}
+		memcpy(&dest->addr, addr, addrlen);
 		dest->addrlen=addrlen;
-		dest->timeout=time(NULL)+timeout;
-		//Add into linked list
-		dest->next=senderDest;
-		senderDest=dest;
+		hashInsert(dest);
+		destList=growArray(destList, &destListAlloced, noDests+1, sizeof(SenderDest*));
+		dest->listIdx=noDests;
+		destList[noDests++]=dest;
+	}
+	if (timeout>0) {
+		dest->expires=curTick+timeout;
+		wheelInsert(dest);
 	}
 	return 1;
 }
@@ -83,48 +298,141 @@ int senderAddDest(char *hostname, int timeout) {
 		perror(hostname);
 		return 0;
 	}
-	return senderAddDestSockaddr(res->ai_addr, res->ai_addrlen, timeout);
+	int r=senderAddDestSockaddr(res->ai_addr, res->ai_addrlen, timeout);
+	freeaddrinfo(res);
+	return r;
 }
 
 #define PAD_LENGTH 0
 
-void senderSendPkt(uint8_t *packet, size_t len) {
-	int r;
-	SenderDstItem *dst=senderDest;
-	len+=PAD_LENGTH; //HACK! Esp32 promiscuous mode seems to eat up some bytes.
-	uint8_t *ppacket=malloc(len+PAD_LENGTH);
-	memcpy(ppacket, packet, len);
-	len+=PAD_LENGTH;
-	while(dst) {
-//		for (int i=0; i<len; i++) ppacket[i]=i;
-//		printf("Sending 0x%X bytes\n", len);
-		r=sendto(senderFd, ppacket, len, 0, dst->addr, dst->addrlen);
-		if (r==-1) {
-			dst->timeout=1; //instantly remove next
-		}
-		dst=dst->next;
+/*
+Packets are not sent immediately but collected in a batch, which is sent out to all destinations
+with as few syscalls as possible: one sendmmsg() call for the entire batch. If the kernel
+supports UDP GSO, all packets for one destination go out as a single message which the kernel
+splits up again; otherwise every (destination, packet) pair is its own message.
+*/
+#define SENDER_MAX_BATCH 32			//max packets in a batch
+#define SENDER_MAX_MSGS_PER_CALL 1024	//UIO_MAXIOV
+
+static PktBuf *batch[SENDER_MAX_BATCH];
+static int batchLen=0;
+
+//Scratch space for building the sendmmsg() vectors. Only grows.
+static struct mmsghdr *msgs;
+static struct iovec *iovs;
+static SenderDest **msgDst;
+static int msgsAlloced, msgDstAlloced, cmsgsAlloced, iovsAlloced;
+
+typedef union {
+	char buf[CMSG_SPACE(sizeof(uint16_t))];
+	struct cmsghdr align;
+} GsoCmsg;
+static GsoCmsg *cmsgs;
+
+//GSO needs all segments but the last one to be the same size.
+static int batchIsGsoable() {
+	if (batchLen<2) return 0;
+	for (int i=1; i<batchLen-1; i++) {
+		if (batch[i]->len!=batch[0]->len) return 0;
 	}
-	free(ppacket);
+	return batch[batchLen-1]->len<=batch[0]->len;
+}
+
+//Build the messages for the current batch. Returns amount of messages.
+static int buildMsgs(int useGso) {
+	int noMsgs=useGso?noDests:noDests*batchLen;
+	int noIovs=noDests*batchLen;
+	msgs=growArray(msgs, &msgsAlloced, noMsgs, sizeof(struct mmsghdr));
+	msgDst=growArray(msgDst, &msgDstAlloced, noMsgs, sizeof(SenderDest*));
+	cmsgs=growArray(cmsgs, &cmsgsAlloced, noMsgs, sizeof(GsoCmsg));
+	iovs=growArray(iovs, &iovsAlloced, noIovs, sizeof(struct iovec));
 
-	//Housekeeping: see if there are dests that need to be killed
-	int notDone=1;
-	do {
-		SenderDstItem *dest, *pdest=NULL;
-		for (dest=senderDest; dest!=NULL; dest=dest->next) {
-			if (dest->timeout!=0 && dest->timeout<time(NULL)) break;
-			pdest=dest;
+	int m=0, v=0;
+	for (int d=0; d<noDests; d++) {
+		SenderDest *dst=destList[d];
+		for (int p=0; p<batchLen; p++) {
+			iovs[v+p].iov_base=batch[p]->data;
+			iovs[v+p].iov_len=batch[p]->len;
 		}
-		if (dest) {
-			if (pdest) {
-				pdest->next=dest->next;
-			} else {
-				senderDest=dest->next;
-			}
-			free(dest);
+		if (useGso) {
+			memset(&msgs[m], 0, sizeof(struct mmsghdr));
+			msgs[m].msg_hdr.msg_name=&dst->addr;
+			msgs[m].msg_hdr.msg_namelen=dst->addrlen;
+			msgs[m].msg_hdr.msg_iov=&iovs[v];
+			msgs[m].msg_hdr.msg_iovlen=batchLen;
+			msgs[m].msg_hdr.msg_control=cmsgs[m].buf;
+			msgs[m].msg_hdr.msg_controllen=sizeof(cmsgs[m].buf);
+			struct cmsghdr *cm=CMSG_FIRSTHDR(&msgs[m].msg_hdr);
+			cm->cmsg_level=SOL_UDP;
+			cm->cmsg_type=UDP_SEGMENT;
+			cm->cmsg_len=CMSG_LEN(sizeof(uint16_t));
+			uint16_t segSize=batch[0]->len;
+			memcpy(CMSG_DATA(cm), &segSize, sizeof(segSize));
+			msgDst[m++]=dst;
 		} else {
-			notDone=0;
+			for (int p=0; p<batchLen; p++) {
+				memset(&msgs[m], 0, sizeof(struct mmsghdr));
+				msgs[m].msg_hdr.msg_name=&dst->addr;
+				msgs[m].msg_hdr.msg_namelen=dst->addrlen;
+				msgs[m].msg_hdr.msg_iov=&iovs[v+p];
+				msgs[m].msg_hdr.msg_iovlen=1;
+				msgDst[m++]=dst;
+			}
+		}
+		v+=batchLen;
+	}
+	return m;
+}
+
+//Send out messages, starting at message pos. Returns -1 when done, or the index of the GSO message
+//that failed if the rest of the batch should be retried without GSO.
+static int sendMsgs(int pos, int noMsgs, int useGso) {
+	while (pos<noMsgs) {
+		int len=noMsgs-pos;
+		if (len>SENDER_MAX_MSGS_PER_CALL) len=SENDER_MAX_MSGS_PER_CALL;
+		int r=sendmmsg(senderFd, &msgs[pos], len, 0);
+		if (r<0 && errno==EINTR) continue;
+		if (r<0) {
+			//msgs[pos] failed.
+			if (useGso && (errno==EIO || errno==EINVAL || errno==ENOPROTOOPT || errno==EOPNOTSUPP)) {
+				printf("sender: UDP GSO send failed (%s); falling back to plain sendmmsg.\n", strerror(errno));
+				gsoEnabled=0;
+				return pos;
+			}
+			destMarkDead(msgDst[pos]);
+			r=1;
 		}
-	} while (notDone);
+		pos+=r;
+	}
+	return -1;
+}
+
+void senderFlush() {
+	if (batchLen==0) return;
+	int useGso=gsoEnabled && batchIsGsoable();
+	int noMsgs=buildMsgs(useGso);
+	int failed=sendMsgs(0, noMsgs, useGso);
+	if (failed>=0) {
+		//GSO isn't going to work. Send the rest of the batch without it. GSO messages are one
+		//per destination, in the same order, so we know where to continue.
+		noMsgs=buildMsgs(0);
+		sendMsgs(failed*batchLen, noMsgs, 0);
+	}
+	for (int i=0; i<batchLen; i++) pktbufFree(batch[i]);
+	batchLen=0;
+
+	while (deadDests) {
+		SenderDest *d=deadDests;
+		deadDests=d->next;
+		destRemove(d);
+	}
+}
+
+void senderSendPkt(PktBuf *packet) {
+	//HACK! Esp32 promiscuous mode seems to eat up some bytes.
+	if (PAD_LENGTH) memset(pktbufPut(packet, PAD_LENGTH), 0, PAD_LENGTH);
+	batch[batchLen++]=packet;
+	if (batchLen==SENDER_MAX_BATCH) senderFlush();
 }
 
 
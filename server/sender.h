@@ -5,8 +5,11 @@
 
 int senderInit();
 int senderAddDest(char *hostname, int timeout);
+//Timeouts are in seconds (senderTick()s); 0 means the destination never expires.
 int senderAddDestSockaddr(struct sockaddr *addr, socklen_t addrlen, int timeout);
-void senderSendPkt(uint8_t *packet, size_t len);
+void senderTick();
+void senderSendPkt(PktBuf *packet);
+void senderFlush();
 int senderGetMaxPacketLength();
 
 #endif
\ No newline at end of file
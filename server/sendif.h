@@ -1,6 +1,9 @@
 #ifndef SENDIF_H
 #define SENDIF_H
 
-typedef void (SendCb)(uint8_t *packet, size_t len);
+#include "pktbuf.h"
+
+//Hands a packet to the next layer down. The callee takes ownership of the buffer.
+typedef void (SendCb)(PktBuf *packet);
 
 #endif
\ No newline at end of file
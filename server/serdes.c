@@ -13,81 +13,146 @@ user-friendly and flexible).
 #include <stdint.h>
 #include <stdlib.h>
 #include <stdio.h>
-#include <unistd.h>
 #include <string.h>
+#include <stddef.h>
 #include <arpa/inet.h>
 #include "sendif.h"
 #include "structs.h"
 #include "crc16.h"
+#include "serdes.h"
 
 #define OUR_MAX_PACKET_LENGTH (8*1024) //semi-randonly chosen
 
 static int sendMaxPktLen;
 static SendCb *sendCb;
-static uint8_t *serdesBuf;
+static PktBuf *serdesBuf;
 static int serdesPos;
+static uint64_t bufDeadline; //earliest deadline of the packets ending in serdesBuf, 0 for none
+static int bufAlign; //PKTBUF_ALIGN_* for serdesBuf
+static PktBufContent bufContent; //what serdesBuf has bytes of
+static PktBufContent pktContent; //the packet being added; it goes into every buffer it touches
+static uint32_t bufSeq; //tailSeq of the last packet ending in serdesBuf
+static uint64_t padBytes;
+
+//While serdesSend copies a packet in, the CRC in its header isn't known yet, so buffers that
+//fill up are held back until it has been filled in.
+static PktBuf **held;
+static int noHeld;
+static int holding;
 
 
 void serdesInit(SendCb *cb, int maxlen) {
 	sendCb=cb;
 	sendMaxPktLen=maxlen;
-	serdesBuf=malloc(maxlen+sizeof(SerdesHdr));
+	serdesBuf=pktbufAlloc(PKTBUF_HEADROOM, sendMaxPktLen);
 	serdesPos=0;
+	bufContent.type=PKTBUF_CONTENT_NONE;
+	pktContent.type=PKTBUF_CONTENT_NONE;
+	held=malloc(sizeof(PktBuf*)*((OUR_MAX_PACKET_LENGTH+sizeof(SerdesHdr))/maxlen+1));
 }
 
 
 
-//Somewhat evil hack to stop transmitting when the badges are likely to be out to lunch because writing flash
-static int waitTimeMs=0;
-static int waitTimeThisBufMs=0;
-
-int serdesWaitAfterSendingNext(int delayMs) {
-	waitTimeMs=delayMs;
-	return delayMs;
+static void sendBuf() {
+	serdesBuf->len=sendMaxPktLen;
+	serdesBuf->deadline=bufDeadline;
+	serdesBuf->align=bufAlign;
+	serdesBuf->content=bufContent;
+	serdesBuf->tailSeq=bufSeq;
+	bufDeadline=0;
+	bufSeq=0;
+	bufAlign=0;
+	bufContent=pktContent;
+	PktBuf *b=serdesBuf;
+	serdesBuf=pktbufAlloc(PKTBUF_HEADROOM, sendMaxPktLen);
+	serdesPos=0;
+	if (holding) {
+		held[noHeld++]=b;
+	} else {
+		sendCb(b);
+	}
 }
 
+static void releaseHeld() {
+	holding=0;
+	for (int i=0; i<noHeld; i++) sendCb(held[i]);
+	noHeld=0;
+}
 
-static void appendToBuf(uint8_t *data, int len) {
+//Copy data into the buffer(s), returns the CRC over it continuing from crc.
+static uint16_t appendToBuf(const uint8_t *data, int len, uint16_t crc) {
 	while (len >= sendMaxPktLen-serdesPos) { //while packet does not fit in buffer
 		int alen=sendMaxPktLen-serdesPos; //room left in buffer
 		//We can only push the packet partially in. Do that and send the packet.
-		memcpy(serdesBuf+serdesPos, data, alen);
+		crc=crc16_ccitt_copy(crc, serdesBuf->data+serdesPos, data, alen);
 		//Adjust data and len to be current
 		data+=alen;
 		len-=alen;
-		//Send and clear buffer
-		sendCb(serdesBuf, sendMaxPktLen);
-		serdesPos=0;
-		if (waitTimeThisBufMs) {
-			printf("Sleeping %d ms to allow flash writes...\n", waitTimeThisBufMs);
-			usleep(waitTimeThisBufMs*1000);
-		}
-		waitTimeThisBufMs=0;
+		//Send buffer and start on a new one
+		sendBuf();
 	}
 	//(rest of) packet is guaranteed to fit in remaining buffer space
-	memcpy(serdesBuf+serdesPos, data, len);
+	crc=crc16_ccitt_copy(crc, serdesBuf->data+serdesPos, data, len);
 	serdesPos+=len;
+	return crc;
 }
 
-void serdesSend(uint8_t *packet, size_t len) {
+void serdesSend(PktBuf *pkt) {
+	uint8_t *packet=pkt->data;
+	size_t len=pkt->len;
 	uint16_t crc;
 	SerdesHdr h;
 	h.magic=htonl(SERDES_MAGIC);
 	h.len=htons(len);
 	h.crc16=0;
-//	crc=crc16_block(0, (uint8_t*)&h, sizeof(SerdesHdr));
-//	h.crc16=htons(crc16_block(crc, packet, len));
-	crc=crc16_ccitt(0, (uint8_t*)&h, sizeof(SerdesHdr));
-	h.crc16=htons(crc16_ccitt(crc, packet, len));
-	appendToBuf((uint8_t*)&h, sizeof(SerdesHdr));
-	//Send entire contents, but trigger wait time after sending last byte to lower layer.
-	appendToBuf(packet, len-1);
-	waitTimeThisBufMs=waitTimeMs;
-	waitTimeMs=0;
-	appendToBuf(&packet[len-1], 1);
+	if (pkt->align&PKTBUF_ALIGN_START) {
+		serdesFlush();
+		bufAlign=PKTBUF_ALIGN_START;
+	}
+	pktContent=pkt->content;
+	pktbufContentMerge(&bufContent, &pktContent);
+	//The CRC gets calculated while copying the packet in, and patched into the header
+	//afterwards. Remember where its two bytes end up; they can be in different buffers.
+	holding=1;
+	uint8_t *hb=(uint8_t*)&h;
+	crc=appendToBuf(hb, offsetof(SerdesHdr, crc16), 0);
+	uint8_t *crcHi=serdesBuf->data+serdesPos;
+	crc=appendToBuf(&hb[offsetof(SerdesHdr, crc16)], 1, crc);
+	uint8_t *crcLo=serdesBuf->data+serdesPos;
+	crc=appendToBuf(&hb[offsetof(SerdesHdr, crc16)+1], 1, crc);
+	//Send entire contents, but hook up the sequence number, deadline and end alignment to the
+	//buffer the last byte ends up in.
+	crc=appendToBuf(packet, len-1, crc);
+	bufSeq=pkt->tailSeq;
+	if (pkt->deadline && (!bufDeadline || pkt->deadline<bufDeadline)) bufDeadline=pkt->deadline;
+	bufAlign|=pkt->align&PKTBUF_ALIGN_END;
+	crc=appendToBuf(&packet[len-1], 1, crc);
+	*crcHi=crc>>8;
+	*crcLo=crc&0xff;
+	pktContent.type=PKTBUF_CONTENT_NONE;
+	releaseHeld();
+	if (pkt->align&PKTBUF_ALIGN_END) serdesFlush();
+	pktbufFree(pkt);
 //	printf("Serdes: buf %d/%d\n", serdesPos, sendMaxPktLen);
 }
 
+//Pad out the current buffer with zeroes (the receiver skips those while looking for the next
+//header) and send it.
+void serdesFlush() {
+	if (serdesPos==0) return;
+	memset(serdesBuf->data+serdesPos, 0, sendMaxPktLen-serdesPos);
+	padBytes+=sendMaxPktLen-serdesPos;
+	sendBuf();
+}
+
+uint64_t serdesGetDeadline() {
+	return serdesPos?bufDeadline:0;
+}
+
+uint64_t serdesGetPadBytes() {
+	return padBytes;
+}
+
 
 int serdesGetMaxPacketLength() {
 	return OUR_MAX_PACKET_LENGTH;
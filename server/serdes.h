@@ -7,7 +7,12 @@
 
 void serdesInit(SendCb *cb, int maxlen);
 int serdesGetMaxPacketLength();
-void serdesSend(uint8_t *packet, size_t len);
-int serdesWaitAfterSendingNext(int delayMs);
+void serdesSend(PktBuf *packet);
+//Pad the partially filled buffer and send it now.
+void serdesFlush();
+//Deadline of the partially filled buffer (see PktBuf), 0 if there is none.
+uint64_t serdesGetDeadline();
+//Bytes of padding serdesFlush() sent.
+uint64_t serdesGetPadBytes();
 
 #endif
\ No newline at end of file
@@ -2,50 +2,308 @@
 Packet signing
 
 Every packet sent out is signed using ECDSA.
+
+Signing is the most expensive thing the send path does, so it can be spread over a pool of
+worker threads. Packets are handed to the workers through a lock-free ring; every packet also
+gets a slot in an ordered completion ring, and signPoll() only passes packets on in the order
+they came in, so the FEC serials on the air stay in order. Only the signature itself is
+computed on the workers; everything else (PktBuf handling, passing packets on) stays on the
+main thread.
+
+In hash-chain mode, packets get a short HashedPacket header instead of a signature, and only
+a hash list (see structs.h) is signed every hashChainLen packets. Receivers can't use packets
+before their list is in, so a list that isn't full yet has a deadline: the earliest deadline of
+the packets in it, but no more than SIGN_LIST_MAX_WAIT_MS after the first one. The main loop
+calls signFlush() when that passes.
 */
+#define _GNU_SOURCE
 #include <stdint.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <unistd.h>
+#include <poll.h>
+#include <time.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <sys/eventfd.h>
 #include <arpa/inet.h>
 #include "sendif.h"
 #include "structs.h"
+#include "sign.h"
 
 #include "ed25519.h"
+#include "sha512.h"
 #include "../keys/privkey.inc"
 #include "../keys/pubkey.inc"
-#include "sha256.h"
 
 
 static int sendMaxPktLen;
 static SendCb *sendCb;
 
+#define SIGN_RING_SIZE 1024 //power of two; max packets in flight
+#define SIGN_RING_MASK (SIGN_RING_SIZE-1)
+#define SIGN_MAX_THREADS 64
+
+//Job ring: bounded MPMC queue (Vyukov), carrying sequence numbers of packets to sign.
+typedef struct {
+	uint32_t cellSeq;
+	uint32_t job;
+} __attribute__ ((aligned(64))) JobCell;
+
+static JobCell jobRing[SIGN_RING_SIZE];
+static uint32_t jobHead __attribute__ ((aligned(64)));
+static uint32_t jobTail __attribute__ ((aligned(64)));
+
+//Completion ring, indexed by sequence number.
+typedef struct {
+	PktBuf *pkt;
+	uint32_t done;
+	int twice;		//send a copy of the signed packet after it
+} __attribute__ ((aligned(64))) DoneSlot;
+
+static DoneSlot doneRing[SIGN_RING_SIZE];
+static uint32_t nextSeq;	//sequence number of the next packet to come in
+static uint32_t nextOut;	//sequence number of the next packet to go out
+
+static int noThreads;
+static pthread_t threads[SIGN_MAX_THREADS];
+static sem_t jobSem;
+static int quit;
+static int doneFd=-1;
+
+static int hashChainLen; //0: sign every packet
+static uint8_t pendingHashes[HASHLIST_MAX_HASHES][HASHLIST_HASH_LEN];
+static int noPendingHashes;
+static uint64_t listDeadline;	//ms, monotonic clock
+
+#define SIGN_LIST_MAX_WAIT_MS 100
+
+static uint64_t nowMs() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec*1000+ts.tv_nsec/1000000;
+}
+
+static int jobPush(uint32_t job) {
+	uint32_t pos=__atomic_load_n(&jobHead, __ATOMIC_RELAXED);
+	while (1) {
+		JobCell *c=&jobRing[pos&SIGN_RING_MASK];
+		int32_t dif=(int32_t)(__atomic_load_n(&c->cellSeq, __ATOMIC_ACQUIRE)-pos);
+		if (dif==0) {
+			if (__atomic_compare_exchange_n(&jobHead, &pos, pos+1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+				c->job=job;
+				__atomic_store_n(&c->cellSeq, pos+1, __ATOMIC_RELEASE);
+				return 1;
+			}
+		} else if (dif<0) {
+			return 0; //full
+		} else {
+			pos=__atomic_load_n(&jobHead, __ATOMIC_RELAXED);
+		}
+	}
+}
+
+static int jobPop(uint32_t *job) {
+	uint32_t pos=__atomic_load_n(&jobTail, __ATOMIC_RELAXED);
+	while (1) {
+		JobCell *c=&jobRing[pos&SIGN_RING_MASK];
+		int32_t dif=(int32_t)(__atomic_load_n(&c->cellSeq, __ATOMIC_ACQUIRE)-(pos+1));
+		if (dif==0) {
+			if (__atomic_compare_exchange_n(&jobTail, &pos, pos+1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+				*job=c->job;
+				__atomic_store_n(&c->cellSeq, pos+SIGN_RING_SIZE, __ATOMIC_RELEASE);
+				return 1;
+			}
+		} else if (dif<0) {
+			return 0; //empty
+		} else {
+			pos=__atomic_load_n(&jobTail, __ATOMIC_RELAXED);
+		}
+	}
+}
+
+static void signPacket(PktBuf *packet) {
+	SignedPacket *p=(SignedPacket*)packet->data;
+	ed25519_sign(p->sig, p->data, packet->len-sizeof(SignedPacket), public_key, private_key);
+}
+
+//Pass a packet on; if twice is set, a copy of it goes right after.
+static void passOn(PktBuf *packet, int twice) {
+	PktBuf *copy=NULL;
+	if (twice) {
+		copy=pktbufAlloc(0, packet->len);
+		memcpy(pktbufPut(copy, packet->len), packet->data, packet->len);
+	}
+	sendCb(packet);
+	if (copy) sendCb(copy);
+}
+
+static void *signWorker(void *arg) {
+	while (1) {
+		sem_wait(&jobSem);
+		uint32_t job;
+		if (!jobPop(&job)) {
+			if (__atomic_load_n(&quit, __ATOMIC_ACQUIRE)) return NULL;
+			continue;
+		}
+		DoneSlot *d=&doneRing[job&SIGN_RING_MASK];
+		signPacket(d->pkt);
+		__atomic_store_n(&d->done, 1, __ATOMIC_RELEASE);
+		uint64_t one=1;
+		if (write(doneFd, &one, sizeof(one))<0) perror("sign: eventfd write");
+	}
+}
+
 void signInit(SendCb *cb, int maxlen) {
 	sendCb=cb;
 	sendMaxPktLen=maxlen;
+	for (int i=0; i<SIGN_RING_SIZE; i++) jobRing[i].cellSeq=i;
+	sem_init(&jobSem, 0, 0);
+	doneFd=eventfd(0, EFD_NONBLOCK);
+	if (doneFd<0) {
+		perror("sign: eventfd");
+		exit(1);
+	}
 }
 
-void signSend(uint8_t *packet, size_t len) {
-	int signMaxPacketLen=(sendMaxPktLen-sizeof(SignedPacket));
-	SignedPacket *p=malloc(sizeof(SignedPacket)+signMaxPacketLen);
-	SHA256_CTX sha;
-	uint8_t hash[32];
-	//Calculate hash of packet
-	sha256_init(&sha);
-	sha256_update(&sha, packet, len);
-	sha256_final(&sha, hash);
+//Wait until all packets in flight have been passed on.
+static void drain() {
+	while (nextOut!=nextSeq) {
+		struct pollfd pfd={.fd=doneFd, .events=POLLIN};
+		poll(&pfd, 1, -1);
+		signPoll();
+	}
+}
+
+int signSetHashChain(int len) {
+	if (len<0 || len>HASHLIST_MAX_HASHES) return 0;
+	hashChainLen=len;
+	return 1;
+}
+
+int signSetThreads(int threadCount) {
+	if (threadCount<0) threadCount=0;
+	if (threadCount>SIGN_MAX_THREADS) threadCount=SIGN_MAX_THREADS;
+	drain();
+	//Stop the current workers; they exit when they find the ring empty with quit set.
+	__atomic_store_n(&quit, 1, __ATOMIC_RELEASE);
+	for (int i=0; i<noThreads; i++) sem_post(&jobSem);
+	for (int i=0; i<noThreads; i++) pthread_join(threads[i], NULL);
+	quit=0;
+	noThreads=0;
+	for (int i=0; i<threadCount; i++) {
+		if (pthread_create(&threads[i], NULL, signWorker, NULL)!=0) {
+			perror("sign: pthread_create");
+			break;
+		}
+		noThreads++;
+	}
+	return noThreads;
+}
+
+int signGetEventFd() {
+	return doneFd;
+}
+
+void signPoll() {
+	uint64_t v;
+	//Reset the eventfd first; a packet finishing after the checks below will set it again.
+	if (read(doneFd, &v, sizeof(v))<0) {
+		//Nothing signalled; fine.
+	}
+	while (nextOut!=nextSeq) {
+		DoneSlot *d=&doneRing[nextOut&SIGN_RING_MASK];
+		if (!__atomic_load_n(&d->done, __ATOMIC_ACQUIRE)) break;
+		d->done=0;
+		nextOut++;
+		passOn(d->pkt, d->twice);
+	}
+}
+
+//Queue a packet to go out after the ones before it. If it still needs signing, a worker does that.
+static void queueOrdered(PktBuf *packet, int needsSigning, int twice) {
+	//Completion ring full: wait for the workers to catch up.
+	while (nextSeq-nextOut==SIGN_RING_SIZE) {
+		struct pollfd pfd={.fd=doneFd, .events=POLLIN};
+		poll(&pfd, 1, -1);
+		signPoll();
+	}
+	DoneSlot *d=&doneRing[nextSeq&SIGN_RING_MASK];
+	d->pkt=packet;
+	d->twice=twice;
+	if (needsSigning) {
+		//The job ring holds at most as many jobs as there are packets in flight, so it can't be full.
+		jobPush(nextSeq);
+		sem_post(&jobSem);
+	} else {
+		d->done=1;
+	}
+	nextSeq++;
+}
+
+static void sendSigned(PktBuf *packet, int twice) {
+	pktbufPush(packet, sizeof(SignedPacket));
+	if (noThreads==0) {
+		//Sign packet
+		signPacket(packet);
+		//Send
+		passOn(packet, twice);
+	} else {
+		queueOrdered(packet, 1, twice);
+	}
+}
+
+static void sendHashList() {
+	int len=sizeof(HashListPacket)+noPendingHashes*HASHLIST_HASH_LEN;
+	PktBuf *p=pktbufAlloc(PKTBUF_HEADROOM, len);
+	HashListPacket *hl=(HashListPacket*)pktbufPut(p, len);
+	hl->magic=htonl(HASHLIST_MAGIC);
+	hl->count=noPendingHashes;
+	memcpy(hl->hash, pendingHashes, noPendingHashes*HASHLIST_HASH_LEN);
+	noPendingHashes=0;
+	//Losing a list loses all packets in it, so send it twice. It's small, and receivers don't
+	//verify the copy again; it's signed once and copied.
+	sendSigned(p, 1);
+}
+
+static void sendHashed(PktBuf *packet) {
+	if (noPendingHashes==0) listDeadline=nowMs()+SIGN_LIST_MAX_WAIT_MS;
+	if (packet->deadline && packet->deadline<listDeadline) listDeadline=packet->deadline;
+	uint8_t hash[64];
+	sha512(packet->data, packet->len, hash);
+	memcpy(pendingHashes[noPendingHashes++], hash, HASHLIST_HASH_LEN);
+	HashedPacket *h=(HashedPacket*)pktbufPush(packet, sizeof(HashedPacket));
+	h->magic=htonl(HASHED_MAGIC);
+	//Keep the order with signed packets still in the works, so receivers see the packets
+	//before the list for them.
+	if (noThreads==0) {
+		sendCb(packet);
+	} else {
+		queueOrdered(packet, 0, 0);
+	}
+	if (noPendingHashes==hashChainLen) sendHashList();
+}
+
+void signSend(PktBuf *packet) {
+	if (hashChainLen && !packet->signAlone) {
+		sendHashed(packet);
+	} else {
+		sendSigned(packet, 0);
+	}
+}
+
+void signFlush() {
+	if (noPendingHashes) sendHashList();
+}
 
-	//Sign packet
-	ed25519_sign(p->sig, packet, len, public_key, private_key);
-	
-	//Send
-	memcpy(p->data, packet, len);
-	sendCb((uint8_t*)p, sizeof(SignedPacket)+len);
-	free(p);
+uint64_t signGetDeadline() {
+	return noPendingHashes?listDeadline:0;
 }
 
 
 int signGetMaxPacketLength() {
+	if (hashChainLen) return sendMaxPktLen-sizeof(HashedPacket);
 	return sendMaxPktLen-sizeof(SignedPacket);
 }
 
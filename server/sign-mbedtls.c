@@ -40,14 +40,14 @@ void signInit(SendCb *cb, int maxlen) {
 
 }
 
-void signSend(uint8_t *packet, size_t len) {
-	int signMaxPacketLen=(sendMaxPktLen-sizeof(SignedPacket));
-	SignedPacket *p=malloc(sizeof(SignedPacket)+signMaxPacketLen);
+void signSend(PktBuf *packet) {
+	size_t len=packet->len;
+	SignedPacket *p=(SignedPacket*)pktbufPush(packet, sizeof(SignedPacket));
 	SHA256_CTX sha;
 	uint8_t hash[32];
 	//Calculate hash of packet
 	sha256_init(&sha);
-	sha256_update(&sha, packet, len);
+	sha256_update(&sha, p->data, len);
 	sha256_final(&sha, hash);
 
 	//Sign packet
@@ -65,9 +65,7 @@ void signSend(uint8_t *packet, size_t len) {
 	printf("HR: %d HS: %d\n", mbedtls_mpi_size(&hr), mbedtls_mpi_size(&hs));
 
 	//Send
-	memcpy(p->data, packet, len);
-	sendCb((uint8_t*)p, sendMaxPktLen);
-	free(p);
+	sendCb(packet);
 }
 
 
@@ -75,3 +73,27 @@ int signGetMaxPacketLength() {
 	return sendMaxPktLen-sizeof(SignedPacket);
 }
 
+
+//No worker threads here; signing is always done inline.
+int signSetThreads(int threadCount) {
+	return 0;
+}
+
+int signGetEventFd() {
+	return -1;
+}
+
+void signPoll() {
+}
+
+//Hash-chain mode needs ed25519; not supported here.
+int signSetHashChain(int len) {
+	return len==0;
+}
+
+void signFlush() {
+}
+
+uint64_t signGetDeadline() {
+	return 0;
+}
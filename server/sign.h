@@ -6,7 +6,20 @@
 
 
 void signInit(SendCb *cb, int maxlen);
-void signSend(uint8_t *packet, size_t len);
+void signSend(PktBuf *packet);
 int signGetMaxPacketLength();
+//Sign on this many worker threads; 0 signs inline in signSend(). Returns the number started.
+int signSetThreads(int threadCount);
+//Readable when signed packets are waiting for signPoll(), -1 if signing never is asynchronous.
+int signGetEventFd();
+//Pass on the packets that are signed, in order.
+void signPoll();
+//Authenticate packets with a signed hash list every len packets instead of signing each one.
+//0 signs every packet. Call before signGetMaxPacketLength(). Returns 0 if len is out of range.
+int signSetHashChain(int len);
+//Send the hash list for the packets sent so far now.
+void signFlush();
+//When the hash list that isn't full yet should go out (see PktBuf), 0 if there is none.
+uint64_t signGetDeadline();
 
 #endif
\ No newline at end of file